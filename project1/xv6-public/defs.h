@@ -78,6 +78,7 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(int, int);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
@@ -106,8 +107,11 @@ int             pipewrite(struct pipe*, char*, int);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             getlevel(void);
 int             growproc(int);
 int             kill(int);
+int             mlfqtick(void);
+void            priorityboost(void);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -0,0 +1,97 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+#define NUM_LOOP 200000
+#define NUM_SLEEP 200
+#define NUM_CHILD 4
+
+int parent;
+
+int
+fork_children(void)
+{
+  int i, p;
+  for (i = 0; i < NUM_CHILD; i++) {
+    p = fork();
+    if (p == 0) {
+      sleep(10);
+      return getpid();
+    }
+  }
+  return parent;
+}
+
+void
+exit_children(void)
+{
+  if (getpid() != parent)
+    exit();
+  while (wait() != -1)
+    ;
+}
+
+void
+print_counts(int pid, int *count)
+{
+  int i;
+  printf(1, "Process %d:", pid);
+  for (i = 0; i < NMLFQ; i++)
+    printf(1, " L%d %d", i, count[i]);
+  printf(1, "\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, x, pid;
+  int count[NMLFQ];
+
+  parent = getpid();
+  printf(1, "MLFQ test start\n");
+
+  // CPU-bound processes use up their quanta and move down.
+  printf(1, "[Test 1] cpu bound\n");
+  pid = fork_children();
+  if (pid != parent) {
+    for (i = 0; i < NMLFQ; i++)
+      count[i] = 0;
+    for (i = 0; i < NUM_LOOP; i++) {
+      x = getLevel();
+      if (x < 0 || x >= NMLFQ) {
+        printf(1, "Wrong level: %d\n", x);
+        exit();
+      }
+      count[x]++;
+    }
+    print_counts(pid, count);
+    if (count[NMLFQ-1] == 0)
+      printf(1, "Process %d never reached L%d\n", pid, NMLFQ-1);
+  }
+  exit_children();
+  printf(1, "[Test 1] finished\n");
+
+  // Processes that sleep right away rarely use a whole quantum
+  // and stay at the top.
+  printf(1, "[Test 2] sleeping\n");
+  pid = fork_children();
+  if (pid != parent) {
+    for (i = 0; i < NMLFQ; i++)
+      count[i] = 0;
+    for (i = 0; i < NUM_SLEEP; i++) {
+      x = getLevel();
+      if (x < 0 || x >= NMLFQ) {
+        printf(1, "Wrong level: %d\n", x);
+        exit();
+      }
+      count[x]++;
+      sleep(1);
+    }
+    print_counts(pid, count);
+  }
+  exit_children();
+  printf(1, "[Test 2] finished\n");
+
+  exit();
+}
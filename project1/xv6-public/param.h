@@ -11,4 +11,6 @@
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
+#define NMLFQ         3  // number of MLFQ levels
+#define BOOSTTICKS  100  // ticks between MLFQ priority boosts
 
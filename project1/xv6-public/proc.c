@@ -4,6 +4,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
+#include "traps.h"
 #include "proc.h"
 #include "spinlock.h"
 
@@ -15,6 +16,7 @@ struct {
 static struct proc *initproc;
 
 int nextpid = 1;
+static uint nextseq;  // MLFQ arrival order; see scheduler()
 extern void forkret(void);
 extern void trapret(void);
 
@@ -65,6 +67,23 @@ myproc(void) {
   return p;
 }
 
+// Wake one CPU that is halted in scheduler(), if any, to run a
+// process that just became RUNNABLE.
+// Caller must hold ptable.lock.
+static void
+kickidle(void)
+{
+  struct cpu *c;
+
+  for(c = cpus; c < &cpus[ncpu]; c++){
+    if(c->idle){
+      c->idle = 0;
+      lapicipi(c->apicid, T_IRQ0 + IRQ_WAKEUP);
+      return;
+    }
+  }
+}
+
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
@@ -88,6 +107,9 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->level = 0;
+  p->qticks = 0;
+  p->qseq = nextseq++;
 
   release(&ptable.lock);
 
@@ -215,6 +237,7 @@ fork(void)
   acquire(&ptable.lock);
 
   np->state = RUNNABLE;
+  kickidle();
 
   release(&ptable.lock);
 
@@ -312,10 +335,89 @@ wait(void)
 }
 
 //PAGEBREAK: 42
+// Multi-level feedback queue.
+// A new process starts at level 0. The time quantum of level i
+// is QUANTUM(i) ticks; a process that uses up its quantum
+// (counted across sleeps, so it can't be gamed by sleeping just
+// before it expires) moves one level down. Every BOOSTTICKS
+// ticks all processes are moved back to level 0 so that none of
+// them starves.
+#define QUANTUM(level) (2*(level) + 4)
+
+// Return the RUNNABLE process at the highest level, round-robin
+// within the level: the one that has waited there longest.
+// The ptable lock must be held.
+static struct proc*
+mlfqpick(void)
+{
+  struct proc *p, *best;
+
+  best = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state != RUNNABLE)
+      continue;
+    if(best == 0 || p->level < best->level ||
+       (p->level == best->level && (int)(p->qseq - best->qseq) < 0))
+      best = p;
+  }
+  return best;
+}
+
+// Charge the current process for one timer tick.
+// Returns 1 if it should give up the CPU: its quantum is used up
+// (it then drops a level) or a process at a higher level is waiting.
+int
+mlfqtick(void)
+{
+  struct proc *p = myproc();
+  struct proc *q;
+  int preempt;
+
+  acquire(&ptable.lock);
+  preempt = 0;
+  if(++p->qticks >= QUANTUM(p->level)){
+    if(p->level < NMLFQ-1)
+      p->level++;
+    p->qticks = 0;
+    preempt = 1;
+  } else {
+    for(q = ptable.proc; q < &ptable.proc[NPROC]; q++){
+      if(q->state == RUNNABLE && q->level < p->level){
+        preempt = 1;
+        break;
+      }
+    }
+  }
+  release(&ptable.lock);
+  return preempt;
+}
+
+// Move every process back to level 0 with a fresh quantum.
+void
+priorityboost(void)
+{
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state == UNUSED)
+      continue;
+    p->level = 0;
+    p->qticks = 0;
+  }
+  release(&ptable.lock);
+}
+
+int
+getlevel(void)
+{
+  return myproc()->level;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run
+//  - choose a process to run (see mlfqpick)
 //  - swtch to start running that process
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
@@ -330,12 +432,8 @@ scheduler(void)
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
     acquire(&ptable.lock);
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
-        continue;
-
+    if((p = mlfqpick()) != 0){
       // Switch to chosen process.  It is the process's job
       // to release ptable.lock and then reacquire it
       // before jumping back to us.
@@ -348,10 +446,22 @@ scheduler(void)
 
       // Process is done running for now.
       // It should have changed its p->state before coming back.
+      // Go to the back of the level.
+      p->qseq = nextseq++;
       c->proc = 0;
-    }
+    } else
+      c->idle = 1;
     release(&ptable.lock);
 
+    if(c->idle){
+      // Nothing was runnable: halt until an interrupt. kickidle()
+      // clears c->idle before sending its IPI, so checking again
+      // with interrupts off means the IPI cannot be missed.
+      cli();
+      if(c->idle)
+        stihlt();
+      c->idle = 0;
+    }
   }
 }
 
@@ -460,8 +570,10 @@ wakeup1(void *chan)
   struct proc *p;
 
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
+    if(p->state == SLEEPING && p->chan == chan){
       p->state = RUNNABLE;
+      kickidle();
+    }
 }
 
 // Wake up all processes sleeping on chan.
@@ -486,8 +598,10 @@ kill(int pid)
     if(p->pid == pid){
       p->killed = 1;
       // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
+      if(p->state == SLEEPING){
         p->state = RUNNABLE;
+        kickidle();
+      }
       release(&ptable.lock);
       return 0;
     }
@@ -523,7 +637,7 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    cprintf("%d %s %s", p->pid, state, p->name);
+    cprintf("%d %s L%d %s", p->pid, state, p->level, p->name);
     if(p->state == SLEEPING){
       getcallerpcs((uint*)p->context->ebp+2, pc);
       for(i=0; i<10 && pc[i] != 0; i++)
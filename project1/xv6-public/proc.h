@@ -8,6 +8,7 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  volatile uint idle;          // Halted in scheduler() waiting for work?
 };
 
 extern struct cpu cpus[NCPU];
@@ -49,6 +50,9 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  int level;                   // MLFQ level, 0 is the highest
+  int qticks;                  // Ticks used of the level's quantum
+  uint qseq;                   // Round-robin order within the level
 };
 
 // Process memory is laid out contiguously, low addresses first:
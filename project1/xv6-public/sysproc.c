@@ -77,6 +77,13 @@ sys_sleep(void)
   return 0;
 }
 
+// return the MLFQ level of the calling process.
+int
+sys_getLevel(void)
+{
+  return getlevel();
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 int
@@ -0,0 +1,142 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NPAGE 16
+#define PGSIZE 4096
+
+char *heap;
+
+void check(int ok, char *what)
+{
+  if (!ok) {
+    printf(1, "%s failed\n", what);
+    exit();
+  }
+}
+
+void fill(int v)
+{
+  int i;
+
+  for (i = 0; i < NPAGE; i++)
+    heap[i * PGSIZE] = v + i;
+}
+
+int filled(int v)
+{
+  int i;
+
+  for (i = 0; i < NPAGE; i++)
+    if (heap[i * PGSIZE] != (char)(v + i))
+      return 0;
+  return 1;
+}
+
+// Parent and child write the same pages and keep their own values,
+// down to a grandchild.
+void private(void)
+{
+  int fd[2], ok;
+
+  fill(1);
+  check(pipe(fd) == 0, "pipe");
+  if (fork() == 0) {
+    ok = filled(1);
+    fill(2);
+    if (fork() == 0) {
+      ok = ok && filled(2);
+      fill(3);
+      write(fd[1], &ok, sizeof(ok));
+      exit();
+    }
+    wait();
+    ok = ok && filled(2);
+    write(fd[1], &ok, sizeof(ok));
+    exit();
+  }
+  fill(4);
+  read(fd[0], &ok, sizeof(ok));
+  check(ok, "grandchild");
+  read(fd[0], &ok, sizeof(ok));
+  check(ok, "child");
+  wait();
+  check(filled(4), "parent");
+  close(fd[0]);
+  close(fd[1]);
+  printf(1, "Test 1 passed\n");
+}
+
+// The kernel writing into a shared page from a system call
+// copies it too.
+void syscall_write(void)
+{
+  int fd[2], ok;
+
+  fill(5);
+  check(pipe(fd) == 0, "pipe");
+  if (fork() == 0) {
+    write(fd[1], "x", 1);
+    read(fd[0], heap, 1);
+    ok = heap[0] == 'x';
+    write(fd[1], &ok, sizeof(ok));
+    exit();
+  }
+  wait();
+  read(fd[0], &ok, sizeof(ok));
+  check(ok, "child read");
+  check(filled(5), "parent after read");
+  close(fd[0]);
+  close(fd[1]);
+  printf(1, "Test 2 passed\n");
+}
+
+void *writer(void *arg)
+{
+  int i = (int)arg;
+
+  heap[i * PGSIZE] = 100 + i;
+  thread_exit(0);
+  return 0;
+}
+
+// Threads started in a child write the child's own pages.
+void threads(void)
+{
+  thread_t t[2];
+  void *retval;
+  int fd[2], i, ok;
+
+  fill(6);
+  check(pipe(fd) == 0, "pipe");
+  if (fork() == 0) {
+    for (i = 0; i < 2; i++) {
+      t[i] = i + 2;
+      check(thread_create(&t[i], writer, (void *)i) == 0, "thread_create");
+    }
+    for (i = 0; i < 2; i++)
+      thread_join(t[i], &retval);
+    ok = heap[0] == 100 && heap[PGSIZE] == 101;
+    write(fd[1], &ok, sizeof(ok));
+    exit();
+  }
+  wait();
+  read(fd[0], &ok, sizeof(ok));
+  check(ok, "threads in child");
+  check(filled(6), "parent after threads");
+  close(fd[0]);
+  close(fd[1]);
+  printf(1, "Test 3 passed\n");
+}
+
+int main(int argc, char *argv[])
+{
+  printf(1, "COW test start\n");
+  heap = sbrk(NPAGE * PGSIZE);
+  check(heap != (char *)-1, "sbrk");
+  private();
+  syscall_write();
+  threads();
+  printf(1, "COW test finished\n");
+  exit();
+}
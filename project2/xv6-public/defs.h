@@ -5,10 +5,12 @@ struct inode;
 struct pipe;
 struct proc;
 struct rtcdate;
+struct segment;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct thread;
 
 // bio.c
 void            binit(void);
@@ -25,6 +27,9 @@ void            panic(char*) __attribute__((noreturn));
 // exec.c
 int             exec(char*, char**);
 int             exec2(char *, char **, int);
+int             loadimage(char*, char**, int, pde_t**, uint*, uint*, uint*,
+                          struct segment*);
+void            putsegs(struct segment*);
 
 // file.c
 struct file*    filealloc(void);
@@ -41,6 +46,7 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            iexec(struct inode*, int);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -67,6 +73,8 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+void            kref(char*);
+int             krefcount(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -79,7 +87,10 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(int, int);
+void            lapiconeshot(uint);
 void            lapicstartap(uchar, uint);
+extern uint     tsctick;
 void            microdelay(int);
 
 // log.c
@@ -96,6 +107,11 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pcache.c
+void            pcinit(void);
+char*           pcget(struct inode*, uint, uint);
+void            pcinval(struct inode*);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
@@ -104,13 +120,16 @@ int             pipewrite(struct pipe*, char*, int);
 
 //PAGEBREAK: 16
 // proc.c
+void            armtimer(void);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+int             killsiblings(void);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
+struct thread*  mythread(void);
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
@@ -122,10 +141,21 @@ int             wait(void);
 void            wakeup(void*);
 void            yield(void);
 int             setmemorylimit(int, int);
+int             spawn(char*, char**, int, int*, int);
+int             set_affinity(int, int, uint);
+int             get_affinity(int, int);
+int             set_tickets(int, int, int);
+int             set_deadline(int, int, int, int);
+int             rtpreempt(void);
 void            proclist(void);
 int             thread_create(thread_t *, void *(*)(void *), void *);
 void            thread_exit(void *);
 int             thread_join(thread_t, void **);
+int             pagefault(uint, int);
+int             thread_settls(uint);
+int             threadstat(uint, int);
+int             futex_wait(uint, uint);
+int             futex_wake(uint, int);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -158,12 +188,18 @@ char*           strncpy(char*, const char*, int);
 int             argint(int, int*);
 int             argptr(int, char**, int);
 int             argstr(int, char**);
+int             argwptr(int, char**, int);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
 void            syscall(void);
 
 // timer.c
+void            clockupdate(void);
+uint            clocknow(void);
+uint            nexttick(void);
 void            timerinit(void);
+void            timertick(void);
+int             tsleep(uint, uint);
 
 // trap.c
 void            idtinit(void);
@@ -185,8 +221,14 @@ int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint);
+pde_t*          copyuvm(pde_t*, uint, int);
+int             cowpage(pde_t*, uint);
+int             unshareuvm(pde_t*, uint);
+int             demandpage(pde_t*, uint, int);
+int             countuvm(pde_t*, uint, uint);
+int             guardpage(pde_t*, uint);
+char*           readpage(struct inode*, uint, uint);
+int             installpage(pde_t*, uint, char*, int);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
@@ -0,0 +1,205 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "tstat.h"
+
+#define NUM_SPINNER 3
+#define NUM_JOB 30
+#define PERIOD 10
+#define RUNTIME 3
+#define DEADLINE 5
+#define DURATION 100
+#define NSTAT 256
+
+int pids[NUM_SPINNER];
+struct tstat stats[NSTAT];
+
+// Deadlines missed by process pid so far.
+int misses(int pid)
+{
+  int i, n;
+
+  n = threadstat(stats, NSTAT);
+  for (i = 0; i < n; i++)
+    if (stats[i].pid == pid)
+      return stats[i].nmiss;
+  return -1;
+}
+
+// Ticks the spinners have run so far.
+int spinticks(void)
+{
+  int i, j, n, total;
+
+  n = threadstat(stats, NSTAT);
+  total = 0;
+  for (i = 0; i < n; i++)
+    for (j = 0; j < NUM_SPINNER; j++)
+      if (stats[i].pid == pids[j])
+        total += stats[i].runticks;
+  return total;
+}
+
+// Fork a process pinned to CPU 0 that sleeps until killed.
+int sleeper(void)
+{
+  int pid;
+
+  if ((pid = fork()) == 0) {
+    for (;;)
+      sleep(1000);
+  }
+  set_affinity(pid, -1, 1);
+  return pid;
+}
+
+void reap(int pid)
+{
+  kill(pid);
+  wait();
+}
+
+void check(int ok, char *what)
+{
+  if (!ok) {
+    printf(1, "%s failed\n", what);
+    exit();
+  }
+}
+
+// Reservations on one CPU may add up to no more than all of it.
+void admission(void)
+{
+  int a, b;
+
+  a = sleeper();
+  b = sleeper();
+  check(set_deadline(a, 10, 6, 10) == 0, "reserve 60%");
+  check(set_deadline(b, 10, 5, 10) != 0, "reject 110%");
+  check(set_deadline(b, 10, 4, 10) == 0, "reserve 100%");
+  check(set_deadline(b, 10, 6, 5) != 0, "reject runtime > deadline");
+  check(set_deadline(b, 10, 3, 11) != 0, "reject deadline > period");
+  check(set_affinity(a, -1, 2) != 0, "keep reserved CPU");
+  check(set_deadline(a, 0, 0, 0) == 0, "unreserve");
+  check(set_deadline(b, 10, 10, 10) == 0, "re-reserve");
+  reap(a);
+  reap(b);
+  printf(1, "Test 1 passed\n");
+}
+
+// Spinners on CPU 0 that run until killed.
+void spinners(void)
+{
+  int i;
+
+  for (i = 0; i < NUM_SPINNER; i++) {
+    if ((pids[i] = fork()) == 0) {
+      for (;;)
+        ;
+    }
+    set_affinity(pids[i], -1, 1);
+    set_tickets(pids[i], -1, 1000);
+  }
+}
+
+void stopspinners(void)
+{
+  int i;
+
+  for (i = 0; i < NUM_SPINNER; i++)
+    reap(pids[i]);
+}
+
+// Fork a child on CPU 0 with a reservation of runtime ticks every
+// PERIOD, due within deadline, and return its pid. The child
+// returns 0 once it has its reservation.
+int rtfork(int runtime, int deadline)
+{
+  int pid, fd[2];
+  char c;
+
+  if (pipe(fd) < 0) {
+    printf(1, "panic at pipe\n");
+    exit();
+  }
+  if ((pid = fork()) == 0) {
+    read(fd[0], &c, 1);
+    close(fd[0]);
+    close(fd[1]);
+    return 0;
+  }
+  set_affinity(pid, -1, 1);
+  check(set_deadline(pid, PERIOD, runtime, deadline) == 0, "set_deadline");
+  write(fd[1], "g", 1);
+  close(fd[0]);
+  close(fd[1]);
+  return pid;
+}
+
+// A periodic task on CPU 0 does a tick of work each period, while
+// the spinners compete for the same CPU. It should finish every
+// job by its deadline.
+void periodic(void)
+{
+  int i, release, late, missed, start;
+
+  spinners();
+  if (rtfork(RUNTIME, DEADLINE) == 0) {
+    release = uptime();
+    late = 0;
+    for (i = 0; i < NUM_JOB; i++) {
+      start = uptime();
+      while (uptime() == start)
+        ;
+      if (uptime() > release + DEADLINE)
+        late++;
+      release += PERIOD;
+      if (release > uptime())
+        sleep(release - uptime());
+    }
+    // Printing may take longer than a period; count misses first.
+    missed = misses(getpid());
+    printf(1, "%d jobs: %d late, %d missed\n", NUM_JOB, late, missed);
+    check(late == 0 && missed == 0, "Test 2");
+    printf(1, "Test 2 passed\n");
+    exit();
+  }
+  wait();
+  stopspinners();
+}
+
+// A task that runs past its runtime misses a deadline every
+// period, and the spinners get the rest of the CPU.
+void overrun(void)
+{
+  int pid, before, missed, spun;
+
+  spinners();
+  if ((pid = rtfork(2, PERIOD)) == 0) {
+    for (;;)
+      ;
+  }
+  sleep(5);
+  before = spinticks();
+  sleep(DURATION);
+  missed = misses(pid);
+  spun = spinticks() - before;
+  reap(pid);
+  stopspinners();
+  printf(1, "%d ticks: %d missed, spinners ran %d\n", DURATION, missed, spun);
+  check(missed >= DURATION / PERIOD - 2, "Test 3 misses");
+  check(spun >= DURATION / 2, "Test 3 spinners");
+  printf(1, "Test 3 passed\n");
+}
+
+int main(int argc, char *argv[])
+{
+  printf(1, "EDF test start\n");
+  // Keep up with the spinners on a single CPU.
+  set_tickets(getpid(), -1, 1000);
+  admission();
+  periodic();
+  overrun();
+  printf(1, "EDF test finished\n");
+  exit();
+}
@@ -2,94 +2,51 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+
+// Copy len bytes from p to va on the stack of a new image in
+// pgdir, mapping the pages they cover. Fails on the guard page.
+static int
+pushstack(pde_t *pgdir, uint va, void *p, uint len)
+{
+  uint a;
 
-int
-exec(char *path, char **argv)
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE)
+    if(demandpage(pgdir, a, 1) < 0)
+      return -1;
+  return copyout(pgdir, va, p, len);
+}
+
+// Replace the current process's image with the ELF file path,
+// with stacksize pages of stack for the calling thread.
+static int
+execimage(char *path, char **argv, int stacksize)
 {
   char *s, *last;
-  int i, off;
-  uint argc, sz, sp, ustack[3+MAXARG+1];
-  struct elfhdr elf;
-  struct inode *ip;
-  struct proghdr ph;
+  uint sz, sp, entry;
   pde_t *pgdir, *oldpgdir;
+  struct segment seg[NSEG], oldseg[NSEG];
   struct proc *curproc = myproc();
-  struct thread *t;
+  struct thread *curthread = mythread();
 
-  begin_op();
-
-  if((ip = namei(path)) == 0){
-    end_op();
-    cprintf("exec: fail\n");
+  if(loadimage(path, argv, stacksize, &pgdir, &sz, &sp, &entry, seg) < 0)
     return -1;
-  }
-  ilock(ip);
-  pgdir = 0;
-
-  // Check ELF header
-  if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
-    goto bad;
-  if(elf.magic != ELF_MAGIC)
-    goto bad;
-
-  if((pgdir = setupkvm()) == 0)
-    goto bad;
-
-  // Load program into memory.
-  sz = 0;
-  for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
-    if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
-      goto bad;
-    if(ph.type != ELF_PROG_LOAD)
-      continue;
-    if(ph.memsz < ph.filesz)
-      goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
-      goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
-    if(ph.vaddr % PGSIZE != 0)
-      goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
-      goto bad;
-  }
-  iunlockput(ip);
-  end_op();
-  ip = 0;
-
-  // Allocate two pages at the next page boundary.
-  // Make the first inaccessible.  Use the second as the user stack.
-  curproc->stacksize = 1;
-  sz = PGROUNDUP(sz);
-  if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE)) == 0)
-    goto bad;
-  clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
-  curproc->ustack[curproc->tidx] = sz;
-  sp = sz;
 
-  // Push argument strings, prepare rest of stack in ustack.
-  for(argc = 0; argv[argc]; argc++) {
-    if(argc >= MAXARG)
-      goto bad;
-    sp = (sp - (strlen(argv[argc]) + 1)) & ~3;
-    if(copyout(pgdir, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
-      goto bad;
-    ustack[3+argc] = sp;
+  // Stop the other threads before their address space goes away;
+  // stacks freed in the old image are no longer valid either.
+  if(killsiblings() < 0){
+    freevm(pgdir);
+    putsegs(seg);
+    return -1;
   }
-  ustack[3+argc] = 0;
-
-  ustack[0] = 0xffffffff;  // fake return PC
-  ustack[1] = argc;
-  ustack[2] = sp - (argc+1)*4;  // argv pointer
-
-  sp -= (3+argc+1) * 4;
-  if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
-    goto bad;
-
+  curproc->nfreestack = 0;
 
   // Save program name for debugging.
   for(last=s=path; *s; s++)
@@ -97,49 +54,51 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
-  // Clean kernel stacks other than using.
-  for (t = curproc->t; t < &(curproc->t[NTHRD]); t++){
-    if (t - curproc->t != curproc->tidx && t->state != UNUSED){
-      kfree(t->kstack);
-      t->kstack = 0;
-      t->state = UNUSED;
-    }
-  }
-
   // Commit to the user image.
   oldpgdir = curproc->pgdir;
+  memmove(oldseg, curproc->seg, sizeof(oldseg));
   curproc->pgdir = pgdir;
+  memmove(curproc->seg, seg, sizeof(seg));
+  curproc->cow = 1;
   curproc->sz = sz;
-  curproc->t[curproc->tidx].tf->eip = elf.entry;  // main
-  curproc->t[curproc->tidx].tf->esp = sp;
+  curthread->ustack = sz;
+  curthread->tls = 0;
+  curthread->tf->gs = 0;
+  curthread->tf->eip = entry;  // main
+  curthread->tf->esp = sp;
   switchuvm(curproc);
   freevm(oldpgdir);
+  putsegs(oldseg);
   return 0;
-
- bad:
-  if(pgdir)
-    freevm(pgdir);
-  if(ip){
-    iunlockput(ip);
-    end_op();
-  }
-  return -1;
 }
 
+int
+exec(char *path, char **argv)
+{
+  if(execimage(path, argv, 1) < 0)
+    return -1;
+  myproc()->stacksize = 1;
+  return 0;
+}
 
-// exec2 : multiple stack (project2)
+// Build a user image for the ELF file path with arguments argv
+// and stacksize pages of stack, in a new page table.
+// The loadable segments are only recorded in seg[0..NSEG), each
+// holding a reference to the file; pagefault() reads their pages
+// in on first touch.
+// On success returns 0 and sets *pgdirp, the image size *szp,
+// the initial stack pointer *spp and the entry point *entryp.
+// Shared by exec(), exec2() and spawn(); touches no process state.
 int
-exec2(char *path, char **argv, int stacksize)
+loadimage(char *path, char **argv, int stacksize, pde_t **pgdirp,
+          uint *szp, uint *spp, uint *entryp, struct segment *seg)
 {
-  char *s, *last;
-  int i, off;
+  int i, off, nseg;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
-  struct thread *t;
+  pde_t *pgdir;
 
   if (stacksize < 1 || stacksize > 100){
     cprintf("stacksize must be in 1~100: %d\n", stacksize);
@@ -155,6 +114,7 @@ exec2(char *path, char **argv, int stacksize)
   }
   ilock(ip);
   pgdir = 0;
+  memset(seg, 0, NSEG*sizeof(seg[0]));
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -165,8 +125,9 @@ exec2(char *path, char **argv, int stacksize)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record where the program's memory comes from.
   sz = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -174,36 +135,47 @@ exec2(char *path, char **argv, int stacksize)
       continue;
     if(ph.memsz < ph.filesz)
       goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
-      goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz >= KERNBASE)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
       goto bad;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
+    if(ph.filesz == 0)
+      continue;
+    if(nseg >= NSEG)
+      goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].end = ph.vaddr + ph.filesz;
+    seg[nseg].off = ph.off;
+    seg[nseg].writable = (ph.flags & ELF_PROG_FLAG_WRITE) != 0;
+    nseg++;
   }
-  iunlockput(ip);
+  // Keep the reference from namei() for the segments, and the
+  // file from being written while they are in use. Counting
+  // under the inode lock keeps out writes in progress.
+  iexec(ip, nseg);
+  iunlock(ip);
   end_op();
-  ip = 0;
 
-  // Allocate two pages at the next page boundary.
-  // Make the first inaccessible.  Use the second as the user stack.
-  curproc->stacksize = stacksize;
+  // Reserve stacksize+1 pages at the next page boundary.
+  // Make the first inaccessible.  Use the rest as the user stack,
+  // mapped on first touch; pushstack() maps the pages it writes.
   sz = PGROUNDUP(sz);
-  if((sz = allocuvm(pgdir, sz, sz + (stacksize + 1)*PGSIZE)) == 0)
-    goto bad;
-  clearpteu(pgdir, (char*)(sz - (stacksize + 1)*PGSIZE));
-  curproc->ustack[curproc->tidx] = sz;
+  if(sz + (stacksize + 1)*PGSIZE >= KERNBASE || guardpage(pgdir, sz) < 0)
+    goto badref;
+  sz += (stacksize + 1)*PGSIZE;
   sp = sz;
 
   // Push argument strings, prepare rest of stack in ustack.
   for(argc = 0; argv[argc]; argc++) {
     if(argc >= MAXARG)
-      goto bad;
+      goto badref;
     sp = (sp - (strlen(argv[argc]) + 1)) & ~3;
-    if(copyout(pgdir, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
-      goto bad;
+    if(pushstack(pgdir, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
+      goto badref;
     ustack[3+argc] = sp;
   }
   ustack[3+argc] = 0;
@@ -213,41 +185,64 @@ exec2(char *path, char **argv, int stacksize)
   ustack[2] = sp - (argc+1)*4;  // argv pointer
 
   sp -= (3+argc+1) * 4;
-  if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
-    goto bad;
+  if(pushstack(pgdir, sp, ustack, (3+argc+1)*4) < 0)
+    goto badref;
 
-  // Save program name for debugging.
-  for(last=s=path; *s; s++)
-    if(*s == '/')
-      last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
-
-  // Clean kernel stacks other than using.
-  for (t = curproc->t; t < &(curproc->t[NTHRD]); t++){
-    if (t - curproc->t != curproc->tidx && t->state != UNUSED){
-      kfree(t->kstack);
-      t->kstack = 0;
-      t->state = UNUSED;
-    }
+  // Each segment holds a reference to ip; the first takes ours.
+  if(nseg == 0){
+    begin_op();
+    iput(ip);
+    end_op();
   }
+  for(i = 0; i < nseg; i++)
+    seg[i].ip = i == 0 ? ip : idup(ip);
 
-  // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->t[curproc->tidx].tf->eip = elf.entry;  // main
-  curproc->t[curproc->tidx].tf->esp = sp;
-  switchuvm(curproc);
-  freevm(oldpgdir);
+  *pgdirp = pgdir;
+  *szp = sz;
+  *spp = sp;
+  *entryp = elf.entry;
   return 0;
 
+ badref:
+  freevm(pgdir);
+  iexec(ip, -nseg);
+  begin_op();
+  iput(ip);
+  end_op();
+  return -1;
+
  bad:
   if(pgdir)
     freevm(pgdir);
-  if(ip){
-    iunlockput(ip);
-    end_op();
-  }
+  iunlockput(ip);
+  end_op();
   return -1;
 }
 
+// Drop the file references of the segments in seg[0..NSEG),
+// letting the file be written again once no program reads it.
+void
+putsegs(struct segment *seg)
+{
+  int i;
+
+  begin_op();
+  for(i = 0; i < NSEG; i++){
+    if(seg[i].ip){
+      iexec(seg[i].ip, -1);
+      iput(seg[i].ip);
+    }
+    seg[i].ip = 0;
+  }
+  end_op();
+}
+
+// exec2 : multiple stack (project2)
+int
+exec2(char *path, char **argv, int stacksize)
+{
+  if(execimage(path, argv, stacksize) < 0)
+    return -1;
+  myproc()->stacksize = stacksize;
+  return 0;
+}
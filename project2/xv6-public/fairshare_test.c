@@ -0,0 +1,170 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "tstat.h"
+#include "x86.h"
+
+#define NUM_THREAD 8
+#define DURATION 300
+#define NSTAT 256
+#define NAPNS 100000  // a nap, in nanoseconds
+
+int end;
+int counts[NUM_THREAD];
+struct tstat stats[NSTAT];
+uint cyclespertick;
+
+// Spin until uptime reaches end and count the rounds.
+int spin(void)
+{
+  int n, i;
+
+  for (n = 0; uptime() < end; n++)
+    for (i = 0; i < 1000; i++)
+      ;
+  return n;
+}
+
+void *thread_main(void *arg)
+{
+  counts[(int)arg] = spin();
+  thread_exit(0);
+  return 0;
+}
+
+// Run nthread spinning threads pinned to CPU 0 and send the
+// total number of rounds they did through fd.
+void child(int nthread, int fd)
+{
+  thread_t thread[NUM_THREAD];
+  void *retval;
+  int i, total;
+
+  set_affinity(getpid(), -1, 1);
+  sleep(1);
+  for (i = 1; i < nthread; i++) {
+    thread[i] = i + 2;
+    if (thread_create(&thread[i], thread_main, (void *)i) != 0) {
+      printf(1, "panic at thread_create\n");
+      exit();
+    }
+  }
+  counts[0] = spin();
+  total = 0;
+  for (i = 0; i < nthread; i++) {
+    if (i > 0)
+      thread_join(thread[i], &retval);
+    total += counts[i];
+  }
+  counts[0] = nthread;
+  counts[1] = total;
+  write(fd, counts, 2 * sizeof(int));
+  exit();
+}
+
+// Compare a process with NUM_THREAD threads against one with a
+// single thread and wsingle tickets; the single-threaded one should
+// get about wsingle/DEFTICKETS times as much CPU as the other.
+void run(int wsingle)
+{
+  int fd[2], r[2], many, one, pid, i;
+
+  pipe(fd);
+  end = uptime() + DURATION;
+  if (fork() == 0)
+    child(NUM_THREAD, fd[1]);
+  if ((pid = fork()) == 0)
+    child(1, fd[1]);
+  set_tickets(pid, -1, wsingle);
+  many = one = 0;
+  for (i = 0; i < 2; i++) {
+    read(fd[0], r, sizeof(r));
+    if (r[0] == 1)
+      one = r[1];
+    else
+      many = r[1];
+  }
+  wait();
+  wait();
+  close(fd[0]);
+  close(fd[1]);
+  printf(1, "tickets %d: %d threads did %d, 1 thread did %d\n", wsingle, NUM_THREAD, many, one);
+}
+
+// TSC cycles per clock tick, timed over a few ticks.
+uint calibrate(void)
+{
+  uint t0, c0;
+
+  t0 = uptime();
+  while (uptime() == t0)
+    ;
+  c0 = rdtsc();
+  while (uptime() < t0 + 11)
+    ;
+  return (rdtsc() - c0) / 10;
+}
+
+// Spin on CPU 0 for most of a tick at a time, napping in between
+// if nap is set.
+void worker(int nap)
+{
+  uint c0;
+
+  set_affinity(getpid(), -1, 1);
+  sleep(1);
+  for (;;) {
+    c0 = rdtsc();
+    while (rdtsc() - c0 < cyclespertick / 10 * 9)
+      ;
+    if (nap)
+      nanosleep(0, NAPNS);
+  }
+}
+
+// Add the ticks process pid has run so far, times sign, to *n.
+void sample(int pid, int sign, int *n)
+{
+  int i, k;
+
+  k = threadstat(stats, NSTAT);
+  for (i = 0; i < k; i++)
+    if (stats[i].pid == pid)
+      *n += sign * stats[i].runticks;
+}
+
+// A process that sleeps just before each tick's worth of running
+// ends, against a spinning one with as many tickets: blocking must
+// not get it more than half of the CPU.
+void napping(void)
+{
+  int pid[2], n[2], i;
+
+  cyclespertick = calibrate();
+  for (i = 0; i < 2; i++) {
+    if ((pid[i] = fork()) == 0)
+      worker(i == 0);
+    n[i] = 0;
+  }
+  sleep(10);
+  for (i = 0; i < 2; i++)
+    sample(pid[i], -1, &n[i]);
+  sleep(DURATION);
+  for (i = 0; i < 2; i++)
+    sample(pid[i], 1, &n[i]);
+  for (i = 0; i < 2; i++)
+    kill(pid[i]);
+  wait();
+  wait();
+  printf(1, "napping process ran %d ticks, spinning process %d\n", n[0], n[1]);
+}
+
+int main(int argc, char *argv[])
+{
+  printf(1, "Fair share test start\n");
+  run(10);
+  run(20);
+  napping();
+  printf(1, "Fair share test finished\n");
+  exit();
+}
@@ -0,0 +1,96 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+#define NUM_FORK 50
+
+int npage;
+
+// Print the result line for ops operations done in ticks.
+void report(char *name, int nproc, uint ops, uint ticks)
+{
+  uint us;
+
+  if (ticks == 0)
+    ticks = 1;
+  us = ticks * (TICKNS / 1000);
+  printf(1, "%s nproc=%d heap_pages=%d ops=%d ticks=%d ops_per_sec=%d "
+         "ns_per_op=%d\n", name, nproc, npage, ops, ticks,
+         ops * (1000000000 / TICKNS) / ticks,
+         us / ops * 1000 + us % ops * 1000 / ops);
+}
+
+// Fork NUM_FORK children one after another and wait for each,
+// after growing the heap by npage written pages. With doexec,
+// each child execs this program to exit at once; with dospawn,
+// the children are spawned running it instead.
+void worker(int doexec, int dospawn)
+{
+  char *argv[] = {"fork_bench", "-exit", 0};
+  char *heap;
+  int i, pid;
+
+  if ((heap = sbrk(npage * 4096)) == (char *)-1) {
+    printf(1, "panic at sbrk\n");
+    exit();
+  }
+  for (i = 0; i < npage; i++)
+    heap[i * 4096] = i;
+  for (i = 0; i < NUM_FORK; i++) {
+    if (dospawn) {
+      if (spawn(argv[0], argv, 1, 0, 0) < 0) {
+        printf(1, "panic at spawn\n");
+        exit();
+      }
+      wait();
+      continue;
+    }
+    if ((pid = fork()) < 0) {
+      printf(1, "panic at fork\n");
+      exit();
+    }
+    if (pid == 0) {
+      if (doexec)
+        exec(argv[0], argv);
+      exit();
+    }
+    wait();
+  }
+  exit();
+}
+
+// Run nproc workers at once and return the ticks they took.
+int run(int nproc, int doexec, int dospawn)
+{
+  int i, start;
+
+  start = uptime();
+  for (i = 0; i < nproc; i++) {
+    if (fork() == 0)
+      worker(doexec, dospawn);
+  }
+  for (i = 0; i < nproc; i++)
+    wait();
+  return uptime() - start;
+}
+
+// fork+wait, fork+exec+wait and spawn+wait rates with nproc
+// processes forking at once, each with npage pages of heap.
+int main(int argc, char *argv[])
+{
+  int nproc;
+
+  if (argc > 1 && strcmp(argv[1], "-exit") == 0)
+    exit();
+  nproc = argc > 1 ? atoi(argv[1]) : 1;
+  npage = argc > 2 ? atoi(argv[2]) : 0;
+  if (nproc < 1 || npage < 0) {
+    printf(1, "usage: fork_bench [nproc [heap_pages]]\n");
+    exit();
+  }
+  report("fork_bench.wait", nproc, nproc * NUM_FORK, run(nproc, 0, 0));
+  report("fork_bench.exec", nproc, nproc * NUM_FORK, run(nproc, 1, 0));
+  report("fork_bench.spawn", nproc, nproc * NUM_FORK, run(nproc, 0, 1));
+  exit();
+}
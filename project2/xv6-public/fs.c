@@ -14,8 +14,8 @@
 #include "param.h"
 #include "stat.h"
 #include "mmu.h"
-#include "proc.h"
 #include "spinlock.h"
+#include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
@@ -282,6 +282,17 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Count n more segments of running programs read from ip, or
+// -n fewer (see exec). writei() refuses to change ip meanwhile,
+// since their pages are read from it on first touch.
+void
+iexec(struct inode *ip, int n)
+{
+  acquire(&icache.lock);
+  ip->nexec += n;
+  release(&icache.lock);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -432,6 +443,7 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  pcinval(ip);
 }
 
 // Copy stat information from inode.
@@ -494,6 +506,8 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(ip->nexec > 0)
+    return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -502,6 +516,8 @@ writei(struct inode *ip, char *src, uint off, uint n)
     log_write(bp);
     brelse(bp);
   }
+  if(n > 0)
+    pcinval(ip);
 
   if(n > 0 && off > ip->size){
     ip->size = off;
@@ -0,0 +1,89 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "x86.h"
+
+#define NUM_SLEEP 50
+#define PERIOD 2
+
+uint cyclespertick;
+
+// TSC cycles per clock tick, timed over a few ticks.
+uint calibrate(void)
+{
+  uint t0, c0;
+
+  t0 = uptime();
+  while (uptime() == t0)
+    ;
+  c0 = rdtsc();
+  while (uptime() < t0 + 11)
+    ;
+  return (rdtsc() - c0) / 10;
+}
+
+// Sleep PERIOD ticks NUM_SLEEP times in a row. Each sleep starts
+// right after the last wakeup, so it should last PERIOD ticks
+// exactly; send the total and the largest difference, in
+// microseconds, through fd. Start once go can be read.
+void sleeper(int go, int fd)
+{
+  uint last, now, ideal, diff, cyclesperus;
+  int i, r[2];
+  char c;
+
+  ideal = PERIOD * cyclespertick;
+  cyclesperus = cyclespertick / (TICKNS / 1000);
+  if (cyclesperus == 0)
+    cyclesperus = 1;
+  r[0] = r[1] = 0;
+  read(go, &c, 1);
+  sleep(1);
+  last = rdtsc();
+  for (i = 0; i < NUM_SLEEP; i++) {
+    sleep(PERIOD);
+    now = rdtsc();
+    diff = now - last > ideal ? now - last - ideal : ideal - (now - last);
+    diff /= cyclesperus;
+    r[0] += diff;
+    if (diff > r[1])
+      r[1] = diff;
+    last = now;
+  }
+  write(fd, r, sizeof(r));
+  exit();
+}
+
+// Sleep wakeup jitter: nproc processes sleep PERIOD ticks at a
+// time, and each wakeup is timed with the TSC.
+int main(int argc, char *argv[])
+{
+  int nproc, i, go[2], fd[2], r[2], total, max;
+
+  nproc = argc > 1 ? atoi(argv[1]) : 1;
+  if (nproc < 1 || pipe(go) < 0 || pipe(fd) < 0) {
+    printf(1, "usage: jitter_bench [nproc]\n");
+    exit();
+  }
+  cyclespertick = calibrate();
+  for (i = 0; i < nproc; i++) {
+    if (fork() == 0)
+      sleeper(go[0], fd[1]);
+  }
+  for (i = 0; i < nproc; i++)
+    write(go[1], "g", 1);
+  total = max = 0;
+  for (i = 0; i < nproc; i++) {
+    read(fd[0], r, sizeof(r));
+    total += r[0];
+    if (r[1] > max)
+      max = r[1];
+  }
+  for (i = 0; i < nproc; i++)
+    wait();
+  printf(1, "jitter_bench nproc=%d sleeps=%d period_us=%d avg_us=%d max_us=%d\n",
+         nproc, nproc * NUM_SLEEP, PERIOD * (TICKNS / 1000),
+         total / (nproc * NUM_SLEEP), max);
+  exit();
+}
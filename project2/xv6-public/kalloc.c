@@ -17,10 +17,15 @@ struct run {
   struct run *next;
 };
 
+// Pages shared copy-on-write between processes (see copyuvm)
+// have a reference for each page table that maps them. kalloc()
+// hands out pages with one reference, and kfree() drops one,
+// freeing the page only when it drops the last.
 struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  uchar ref[PHYSTOP / PGSIZE];  // References to each physical page
 } kmem;
 
 // Initialization happens in two phases.
@@ -64,6 +69,19 @@ kfree(char *v)
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if(kmem.ref[V2P(v) / PGSIZE] > 1){
+    // Still mapped by someone else.
+    kmem.ref[V2P(v) / PGSIZE]--;
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    return;
+  }
+  kmem.ref[V2P(v) / PGSIZE] = 0;
+  if(kmem.use_lock)
+    release(&kmem.lock);
+
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
@@ -87,10 +105,33 @@ kalloc(void)
   if(kmem.use_lock)
     acquire(&kmem.lock);
   r = kmem.freelist;
-  if(r)
+  if(r){
     kmem.freelist = r->next;
+    kmem.ref[V2P(r) / PGSIZE] = 1;
+  }
   if(kmem.use_lock)
     release(&kmem.lock);
   return (char*)r;
 }
 
+// Add a reference to the page v, which is about to be mapped
+// by one more page table.
+void
+kref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kref");
+  acquire(&kmem.lock);
+  if(kmem.ref[V2P(v) / PGSIZE] == 0xff)
+    panic("kref: too many");
+  kmem.ref[V2P(v) / PGSIZE]++;
+  release(&kmem.lock);
+}
+
+// The number of references to the page v.
+int
+krefcount(char *v)
+{
+  return kmem.ref[V2P(v) / PGSIZE];
+}
+
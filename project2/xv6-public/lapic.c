@@ -41,7 +41,10 @@
 #define TCCR    (0x0390/4)   // Timer Current Count
 #define TDCR    (0x03E0/4)   // Timer Divide Configuration
 
+#define TICKCOUNT 10000000  // Timer counts per clock tick
+
 volatile uint *lapic;  // Initialized in mp.c
+uint tsctick;          // TSC cycles per clock tick, measured by lapicinit
 
 //PAGEBREAK!
 static void
@@ -65,8 +68,24 @@ lapicinit(void)
   // If xv6 cared more about precise timekeeping,
   // TICR would be calibrated using an external time source.
   lapicw(TDCR, X1);
-  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  // Time within a tick is kept with the TSC, so first count how
+  // many TSC cycles one tick's worth of timer counts takes.
+  if(tsctick == 0){
+    lapicw(TIMER, MASKED | (T_IRQ0 + IRQ_TIMER));
+    lapicw(TICR, TICKCOUNT);
+    tsctick = rdtsc();
+    while(lapic[TCCR] != 0)
+      ;
+    tsctick = rdtsc() - tsctick;
+  }
+  if(TICKLESS){
+    // One-shot: armtimer() programs the timer for each next event.
+    lapicw(TIMER, T_IRQ0 + IRQ_TIMER);
+    lapicw(TICR, TICKCOUNT);
+  } else {
+    lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+    lapicw(TICR, TICKCOUNT);
+  }
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -113,6 +132,30 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Interrupt this CPU once after n TICKFRAC-ths of a tick, or
+// never if n is 0. Only used in TICKLESS mode.
+void
+lapiconeshot(uint n)
+{
+  if(!lapic)
+    return;
+  lapicw(TICR, n * (TICKCOUNT / TICKFRAC));
+}
+
+// Send interrupt vector to the CPU with the given APIC ID.
+// Must be called with interrupts disabled, since ICRHI and
+// ICRLO are written separately.
+void
+lapicipi(int apicid, int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
@@ -0,0 +1,315 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "elf.h"
+
+#define PGSIZE 4096
+#define NPAGE 1024
+#define NSTACK 100
+#define NDATA 8
+
+// Initialized data, read from the program file on first touch.
+char data[NDATA * PGSIZE] = {
+  [0] = 1, [PGSIZE] = 2, [3 * PGSIZE + 9] = 4, [NDATA * PGSIZE - 1] = 8,
+};
+
+void check(int ok, char *what)
+{
+  if (!ok) {
+    printf(1, "%s failed\n", what);
+    exit();
+  }
+}
+
+// A big heap reads as zeros and keeps what is written to it,
+// also in a forked child.
+void heap(void)
+{
+  char *p;
+  int i, fd[2], ok;
+
+  p = sbrk(NPAGE * PGSIZE);
+  check(p != (char *)-1, "sbrk");
+  for (i = 0; i < NPAGE; i++)
+    check(p[i * PGSIZE + 7] == 0, "zero read");
+  for (i = 0; i < NPAGE; i += 3)
+    p[i * PGSIZE] = i;
+  check(pipe(fd) == 0, "pipe");
+  if (fork() == 0) {
+    ok = 1;
+    for (i = 0; i < NPAGE; i++)
+      if (p[i * PGSIZE] != (i % 3 == 0 ? (char)i : 0))
+        ok = 0;
+    p[PGSIZE] = 1;
+    write(fd[1], &ok, sizeof(ok));
+    exit();
+  }
+  read(fd[0], &ok, sizeof(ok));
+  wait();
+  check(ok, "child heap");
+  check(p[PGSIZE] == 0, "parent heap");
+  close(fd[0]);
+  close(fd[1]);
+  sbrk(-NPAGE * PGSIZE);
+  printf(1, "Test 1 passed\n");
+}
+
+// The memory limit counts the pages that were touched, not the
+// size of the heap.
+void limit(void)
+{
+  char *p;
+  int i, fd[2], n;
+
+  check(pipe(fd) == 0, "pipe");
+  if (fork() == 0) {
+    close(fd[0]);
+    check(setmemorylimit(getpid(), 64 * PGSIZE) == 0, "setmemorylimit");
+    p = sbrk(NPAGE * PGSIZE);
+    check(p != (char *)-1, "sbrk past limit");
+    for (i = 0; i < NPAGE; i++) {
+      p[i * PGSIZE] = 1;
+      write(fd[1], &i, sizeof(i));
+    }
+    exit();
+  }
+  close(fd[1]);
+  i = -1;
+  while (read(fd[0], &n, sizeof(n)) == sizeof(n))
+    i = n;
+  wait();
+  close(fd[0]);
+  check(i > 0 && i < 64, "killed at limit");
+
+  // Neither do system calls writing to the heap for it.
+  check(pipe(fd) == 0, "pipe");
+  if (fork() == 0) {
+    close(fd[0]);
+    check(setmemorylimit(getpid(), 64 * PGSIZE) == 0, "setmemorylimit");
+    p = sbrk(NPAGE * PGSIZE);
+    check(p != (char *)-1, "sbrk past limit");
+    n = open("lazy_test", O_RDONLY);
+    check(n >= 0, "open self");
+    for (i = 0; i < NPAGE; i++) {
+      if (p[i * PGSIZE] != 0 || read(n, &p[i * PGSIZE], 1) != 1)
+        break;
+    }
+    write(fd[1], &i, sizeof(i));
+    exit();
+  }
+  close(fd[1]);
+  i = -1;
+  read(fd[0], &i, sizeof(i));
+  wait();
+  close(fd[0]);
+  check(i > 0 && i < 64, "read stopped at limit");
+  printf(1, "Test 2 passed\n");
+}
+
+// Use most of a NSTACK-page stack, then report through fd.
+int deep(int n)
+{
+  char buf[PGSIZE - 64];
+
+  buf[0] = n;
+  if (n > 0)
+    return deep(n - 1) + buf[0] - n;
+  return 0;
+}
+
+// A program started with a big stack can use all of it.
+void stack(void)
+{
+  char *argv[] = {"lazy_test", "-stack", 0};
+  int fd[2], ok;
+
+  check(pipe(fd) == 0, "pipe");
+  check(spawn(argv[0], argv, NSTACK, fd, 2) > 0, "spawn");
+  ok = 0;
+  close(fd[1]);
+  read(fd[0], &ok, sizeof(ok));
+  wait();
+  close(fd[0]);
+  check(ok, "deep stack");
+  printf(1, "Test 3 passed\n");
+}
+
+// Tells apart copies of this program (see rewrite).
+char marker[] = "page cache marker A";
+
+int dataok(void)
+{
+  return data[0] == 1 && data[PGSIZE] == 2 && data[3 * PGSIZE + 9] == 4 &&
+         data[NDATA * PGSIZE - 1] == 8 && data[2 * PGSIZE] == 0;
+}
+
+// Initialized data reads back from the file, also in a child
+// that touches it first, and writes to it stay private.
+void program(void)
+{
+  int fd[2], ok;
+
+  check(pipe(fd) == 0, "pipe");
+  if (fork() == 0) {
+    ok = dataok();
+    data[PGSIZE] = 5;
+    write(fd[1], &ok, sizeof(ok));
+    exit();
+  }
+  read(fd[0], &ok, sizeof(ok));
+  wait();
+  check(ok, "child data");
+  check(dataok(), "parent data");
+  close(fd[0]);
+  close(fd[1]);
+  printf(1, "Test 4 passed\n");
+}
+
+// Write a copy of this program to path, with the last letter of
+// marker set to c and the flags in clear cleared in its program
+// headers. Returns 0, or -1 if path cannot be written.
+int copyself(char *path, char c, uint clear)
+{
+  struct stat st;
+  struct elfhdr *elf;
+  struct proghdr *ph;
+  char *buf;
+  int fd, i, j, n, r;
+
+  n = sizeof(marker) - 1;
+  fd = open("lazy_test", O_RDONLY);
+  check(fd >= 0 && fstat(fd, &st) == 0, "open self");
+  buf = sbrk(st.size);
+  check(buf != (char *)-1 && read(fd, buf, st.size) == st.size, "read self");
+  close(fd);
+  for (i = 0; i + n <= st.size; i++) {
+    for (j = 0; j < n && buf[i + j] == marker[j]; j++)
+      ;
+    if (j == n)
+      break;
+  }
+  check(i + n <= st.size, "find marker");
+  buf[i + n - 1] = c;
+  elf = (struct elfhdr *)buf;
+  ph = (struct proghdr *)(buf + elf->phoff);
+  for (i = 0; i < elf->phnum; i++)
+    ph[i].flags &= ~clear;
+  fd = open(path, O_CREATE | O_WRONLY);
+  check(fd >= 0, "create copy");
+  r = write(fd, buf, st.size) == st.size ? 0 : -1;
+  close(fd);
+  sbrk(-st.size);
+  return r;
+}
+
+// Start the program at path, which waits for a byte on in and
+// then writes its marker letter to out.
+void startcopy(char *path, int *in, int *out)
+{
+  char *argv[] = {path, "-marker", 0};
+  int fd[2];
+
+  check(pipe(in) == 0 && pipe(out) == 0, "pipe");
+  fd[0] = in[0];
+  fd[1] = out[1];
+  check(spawn(path, argv, 1, fd, 2) > 0, "spawn copy");
+  close(in[0]);
+  close(out[1]);
+}
+
+// The marker letter of the program started by startcopy.
+char finishcopy(int *in, int *out)
+{
+  char c;
+
+  write(in[1], "x", 1);
+  c = 0;
+  read(out[0], &c, 1);
+  wait();
+  close(in[1]);
+  close(out[0]);
+  return c;
+}
+
+// The marker letter of the program at path.
+char runmarker(char *path)
+{
+  int in[2], out[2];
+
+  startcopy(path, in, out);
+  return finishcopy(in, out);
+}
+
+// A program file cannot be rewritten while it runs, and once
+// rewritten runs its new contents, not pages cached from the
+// old file.
+void rewrite(void)
+{
+  int in[2], out[2];
+
+  check(copyself("lazycopy", 'A', 0) == 0, "write copy");
+  check(runmarker("lazycopy") == 'A', "first run");
+  startcopy("lazycopy", in, out);
+  check(copyself("lazycopy", 'B', 0) < 0, "rewrite refused while running");
+  check(finishcopy(in, out) == 'A', "running copy");
+  check(copyself("lazycopy", 'B', 0) == 0, "rewrite");
+  check(runmarker("lazycopy") == 'B', "run after rewrite");
+  unlink("lazycopy");
+  printf(1, "Test 5 passed\n");
+}
+
+// A system call does not write to a read-only page of a program
+// for it either, but fails. The copy run here has a read-only
+// image; it writes nothing outside its stack.
+void readonly(void)
+{
+  char *argv[] = {"lazycopy", "-text", 0};
+  int fd[2], map[2], ok;
+
+  check(copyself("lazycopy", 'A', ELF_PROG_FLAG_WRITE) == 0, "write copy");
+  check(pipe(fd) == 0, "pipe");
+  map[0] = 0;
+  map[1] = fd[1];
+  check(spawn("lazycopy", argv, 1, map, 2) > 0, "spawn copy");
+  close(fd[1]);
+  ok = 0;
+  read(fd[0], &ok, sizeof(ok));
+  wait();
+  close(fd[0]);
+  check(ok, "system call writing to text");
+  unlink("lazycopy");
+  printf(1, "Test 6 passed\n");
+}
+
+int main(int argc, char *argv[])
+{
+  int ok, fd[2];
+
+  if (argc > 1 && strcmp(argv[1], "-stack") == 0) {
+    ok = deep(NSTACK - 5) == 0;
+    write(1, &ok, sizeof(ok));
+    exit();
+  }
+  if (argc > 1 && strcmp(argv[1], "-text") == 0) {
+    ok = pipe(fd) == 0 && write(fd[1], "x", 1) == 1 &&
+         read(fd[0], (char *)main, 1) < 0 &&
+         fstat(fd[0], (struct stat *)main) < 0;
+    write(1, &ok, sizeof(ok));
+    exit();
+  }
+  if (argc > 1 && strcmp(argv[1], "-marker") == 0) {
+    read(0, &ok, 1);
+    write(1, &marker[sizeof(marker) - 2], 1);
+    exit();
+  }
+  printf(1, "Lazy allocation test start\n");
+  heap();
+  limit();
+  stack();
+  program();
+  rewrite();
+  readonly();
+  printf(1, "Lazy allocation test finished\n");
+  exit();
+}
@@ -3,6 +3,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "x86.h"
 
@@ -28,7 +29,9 @@ main(void)
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
+  timerinit();     // clock for TICKLESS mode
   binit();         // buffer cache
+  pcinit();        // program page cache
   fileinit();      // file table
   ideinit();       // disk 
   startothers();   // start other processors
@@ -1,5 +1,4 @@
 #define NPROC        64  // maximum number of processes
-#define NTHRD        16  // maximum number of threads
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
@@ -11,5 +10,15 @@
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define FSSIZE       4000  // size of file system in blocks
+#define TICKNS   10000000  // nominal length of a clock tick (ns)
+#define TICKLESS      1  // 1: one-shot LAPIC timer per event, 0: periodic
+#define NOHZMAX      50  // most ticks CPU 0 goes without a timer interrupt
+#define TICKFRAC   1024  // timers and CPU time kept to 1/TICKFRAC tick
+#define NTIDHASH      16  // tid hash buckets per process
+#define NWAITHASH     64  // wait queues for sleep channels
+#define DEFTICKETS     10  // default stride-scheduling tickets
+#define MAXTICKETS   1000  // maximum tickets of a process or thread
+#define NSEG           4  // maximum loadable ELF segments per program
+#define NPCACHE      128  // size of program page cache, in pages
 
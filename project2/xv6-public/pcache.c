@@ -0,0 +1,135 @@
+// Program page cache.
+//
+// The page cache keeps pages of program files, as read in by
+// pagefault(), so that every process running the same program
+// maps the same physical pages instead of reading its own copy.
+// Pages are mapped read-only; a process that writes one gets a
+// private copy (see cowpage).
+//
+// Interface:
+// * To get the page holding n bytes of a file at offset off,
+//     followed by zeros, call pcget.
+// * Call pcinval when the contents of a file change.
+//
+// Pages are reference-counted (see kalloc.c): the cache holds
+// one reference and each mapping another, so a page stays valid
+// for processes mapping it after the cache drops it. The least
+// recently used page that no process maps makes room for a new one.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+struct cpage {
+  uint dev;
+  uint inum;
+  uint off;
+  uint n;
+  char *mem;                   // The page, or 0 if the entry is free
+  uint used;                   // When it was last handed out
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage page[NPCACHE];
+  uint clock;                  // Counts pcget()s, for LRU
+  uint gen;                    // Counts pcinval()s
+} pcache;
+
+void
+pcinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Return a page holding n bytes of ip from offset off, then
+// zeros, with a reference for the caller, who must kfree it.
+// Returns 0 if out of memory or the file cannot be read.
+// Sleeps, so the caller must hold no spinlock.
+char*
+pcget(struct inode *ip, uint off, uint n)
+{
+  struct cpage *c, *victim;
+  char *mem;
+  uint gen;
+
+  acquire(&pcache.lock);
+  for(c = pcache.page; c < pcache.page+NPCACHE; c++){
+    if(c->mem && c->dev == ip->dev && c->inum == ip->inum &&
+       c->off == off && c->n == n){
+      c->used = ++pcache.clock;
+      kref(c->mem);
+      mem = c->mem;
+      release(&pcache.lock);
+      return mem;
+    }
+  }
+  gen = pcache.gen;
+  release(&pcache.lock);
+
+  if((mem = readpage(ip, off, n)) == 0)
+    return 0;
+
+  acquire(&pcache.lock);
+  // Don't cache what the file held before a write that raced
+  // with the read.
+  if(gen != pcache.gen){
+    release(&pcache.lock);
+    return mem;
+  }
+  victim = 0;
+  for(c = pcache.page; c < pcache.page+NPCACHE; c++){
+    if(c->mem && c->dev == ip->dev && c->inum == ip->inum &&
+       c->off == off && c->n == n){
+      // Another process read the same page meanwhile.
+      c->used = ++pcache.clock;
+      kref(c->mem);
+      kfree(mem);
+      mem = c->mem;
+      release(&pcache.lock);
+      return mem;
+    }
+    // Prefer a free entry, then the least recently used
+    // page that is mapped nowhere.
+    if(c->mem && krefcount(c->mem) > 1)
+      continue;
+    if(victim == 0 ||
+       (victim->mem && (c->mem == 0 || c->used < victim->used)))
+      victim = c;
+  }
+  if(victim){
+    if(victim->mem)
+      kfree(victim->mem);
+    victim->dev = ip->dev;
+    victim->inum = ip->inum;
+    victim->off = off;
+    victim->n = n;
+    victim->mem = mem;
+    victim->used = ++pcache.clock;
+    kref(mem);
+  }
+  release(&pcache.lock);
+  return mem;
+}
+
+// Drop the cached pages of ip, whose contents have changed.
+// Processes that map them keep the old contents.
+void
+pcinval(struct inode *ip)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  pcache.gen++;
+  for(c = pcache.page; c < pcache.page+NPCACHE; c++){
+    if(c->mem && c->dev == ip->dev && c->inum == ip->inum){
+      kfree(c->mem);
+      c->mem = 0;
+    }
+  }
+  release(&pcache.lock);
+}
@@ -1,21 +1,43 @@
 #include "types.h"
 #include "user.h"
+#include "tstat.h"
+
+#define NSTAT 256
+
+struct tstat stats[NSTAT];
+
+char *states[] = {"unused", "embryo", "sleep ", "runble", "run   ", "zombie"};
+
+void
+threadlist(void)
+{
+    int i, n;
+
+    n = threadstat(stats, NSTAT);
+    printf(1, "pid\ttid\tstate\tcpu\tmask\trun\twait\tvol\tinvol\tmiss\n");
+    printf(1, "=============================================================================\n");
+    for (i = 0; i < n; i++){
+        printf(1, "%d\t%d\t%s\t%d\t%x\t%d\t%d\t%d\t%d\t%d\n", stats[i].pid, stats[i].tid,
+               states[stats[i].state], stats[i].cpu, stats[i].affinity, stats[i].runticks,
+               stats[i].waitticks, stats[i].nvswitch, stats[i].nivswitch, stats[i].nmiss);
+    }
+}
 
 int
 main()
 {
     char com[100];
-    char *arg[2];
+    char *arg[4], *argv[2];
     int i, j;
 
     while (1){
         for (i = 0; i < 100; i++) com[i] = 0;
-        arg[0] = arg[1] = 0;
+        arg[0] = arg[1] = arg[2] = arg[3] = 0;
         // read and parse command and arg
         read(0, com, 100);
         j = 0;
         for (i = 0; i < 100; i++){
-            if (com[i] == ' '){
+            if (com[i] == ' ' && j < 4){
                 com[i] = 0;
                 arg[j] = com + i + 1;
                 j++;
@@ -28,19 +50,28 @@ main()
         // system call
         if (strcmp(com, "list") == 0){
             proclist();
+        }else if (strcmp(com, "stat") == 0){
+            threadlist();
         }else if (strcmp(com, "kill") == 0){
             if (kill(atoi(arg[0])) == 0) printf(1, "kill succeed\n");
             else printf(1, "kill failed\n");
         }else if (strcmp(com, "execute") == 0){
-            if (fork() == 0) {
-                if (execute(arg[0], atoi(arg[1])) == -1){
-                    printf(1, "execution failed\n");
-                    exit();
-                }
-            }
+            argv[0] = arg[0];
+            argv[1] = 0;
+            if (spawn(arg[0], argv, atoi(arg[1]), 0, 0) < 0)
+                printf(1, "execution failed\n");
         }else if (strcmp(com, "memlim") == 0){
             if (setmemorylimit(atoi(arg[0]), atoi(arg[1])) == 0) printf(1, "setting succeed\n");
             else printf(1, "setting failed\n");
+        }else if (strcmp(com, "affinity") == 0){
+            if (set_affinity(atoi(arg[0]), -1, atoi(arg[1])) == 0) printf(1, "setting succeed\n");
+            else printf(1, "setting failed\n");
+        }else if (strcmp(com, "tickets") == 0){
+            if (set_tickets(atoi(arg[0]), -1, atoi(arg[1])) == 0) printf(1, "setting succeed\n");
+            else printf(1, "setting failed\n");
+        }else if (strcmp(com, "deadline") == 0){
+            if (set_deadline(atoi(arg[0]), atoi(arg[1]), atoi(arg[2]), atoi(arg[3])) == 0) printf(1, "setting succeed\n");
+            else printf(1, "setting failed\n");
         }else if (strcmp(com, "exit") == 0){
             exit();
         }
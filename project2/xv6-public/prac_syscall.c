@@ -1,5 +1,6 @@
 #include "types.h"
 #include "defs.h"
+#include "tstat.h"
 
 int execute(char *path, int stacksize){
     char *argv[] = {path, 0};
@@ -12,10 +13,11 @@ int sys_proclist(void){
 }
 
 int sys_execute(void){
-    int stacksize, path;
-    if (argint(0, &path) != 0 || argint(1, &stacksize) != 0)
+    int stacksize;
+    char *path;
+    if (argstr(0, &path) < 0 || argint(1, &stacksize) != 0)
         return -1;
-    return execute((char *)path, stacksize);
+    return execute(path, stacksize);
 }
 
 int sys_setmemorylimit(void){
@@ -25,10 +27,40 @@ int sys_setmemorylimit(void){
     return setmemorylimit(pid, limit);
 }
 
+int sys_set_affinity(void){
+    int pid, tid, mask;
+    if (argint(0, &pid) != 0 || argint(1, &tid) != 0 || argint(2, &mask) != 0)
+        return -1;
+    return set_affinity(pid, tid, (uint)mask);
+}
+
+int sys_get_affinity(void){
+    int pid, tid;
+    if (argint(0, &pid) != 0 || argint(1, &tid) != 0)
+        return -1;
+    return get_affinity(pid, tid);
+}
+
+int sys_set_tickets(void){
+    int pid, tid, n;
+    if (argint(0, &pid) != 0 || argint(1, &tid) != 0 || argint(2, &n) != 0)
+        return -1;
+    return set_tickets(pid, tid, n);
+}
+
+int sys_set_deadline(void){
+    int pid, period, runtime, deadline;
+    if (argint(0, &pid) != 0 || argint(1, &period) != 0 ||
+        argint(2, &runtime) != 0 || argint(3, &deadline) != 0)
+        return -1;
+    return set_deadline(pid, period, runtime, deadline);
+}
+
 // syscall to test thread implementation
 int sys_thread_create(void){
-    int tid, start_routine, arg;
-    if (argint(0, &tid) != 0 || argint(1, &start_routine) != 0 || argint(2, &arg) != 0)
+    char *tid;
+    int start_routine, arg;
+    if (argwptr(0, &tid, sizeof(thread_t)) != 0 || argint(1, &start_routine) != 0 || argint(2, &arg) != 0)
         return -1;
     return thread_create((thread_t *)tid, (void *(*)(void *))start_routine, (void *)arg);
 }
@@ -42,8 +74,38 @@ int sys_thread_exit(void){
 }
 
 int sys_thread_join(void){
-    int tid, retval;
-    if (argint(0, &tid) != 0 || argint(1, &retval) != 0)
+    int tid;
+    char *retval;
+    if (argint(0, &tid) != 0 || argwptr(1, &retval, sizeof(void *)) != 0)
         return -1;
     return thread_join((thread_t)tid, (void **)retval);
 }
+
+int sys_thread_settls(void){
+    int base;
+    if (argint(0, &base) != 0)
+        return -1;
+    return thread_settls((uint)base);
+}
+
+int sys_threadstat(void){
+    char *buf;
+    int n;
+    if (argint(1, &n) != 0 || n < 0 || argptr(0, &buf, n * sizeof(struct tstat)) != 0)
+        return -1;
+    return threadstat((uint)buf, n);
+}
+
+int sys_futex_wait(void){
+    int addr, val;
+    if (argint(0, &addr) != 0 || argint(1, &val) != 0)
+        return -1;
+    return futex_wait((uint)addr, (uint)val);
+}
+
+int sys_futex_wake(void){
+    int addr, n;
+    if (argint(0, &addr) != 0 || argint(1, &n) != 0)
+        return -1;
+    return futex_wake((uint)addr, n);
+}
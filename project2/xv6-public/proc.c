@@ -4,27 +4,102 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
-#include "proc.h"
+#include "traps.h"
 #include "spinlock.h"
-
+#include "proc.h"
+#include "tstat.h"
+
+#define ALLCPUS  (~0U)
+#define STRIDE1  (MAXTICKETS * 100)  // pass charged per tick at 1 ticket
+#define RTUNIT   10000               // EDF utilization of a whole CPU
+#define MAXPERIOD 100000             // Longest EDF period, in ticks
+
+// Each process has its own lock, so that processes on different
+// CPUs do not contend; see struct proc. ptable.lock only guards
+// the allocation of pids and the EDF reservations (rtutil).
+// ptable.waitlock guards every p->parent and is what wait()
+// sleeps on, so that an exiting child cannot miss its parent.
+// Lock order: waitlock, then p->lock, then ptable.lock.
 struct {
   struct spinlock lock;
+  struct spinlock waitlock;
   struct proc proc[NPROC];
 } ptable;
 
+// Per-CPU queues of RUNNABLE threads. Each queue has its own
+// lock so that picking the next thread does not scan ptable;
+// a CPU whose queue is empty steals from the longest other one.
+// A thread is put on a queue only while its process's lock is
+// held (lock order: p->lock, then runq lock).
+//
+// CPU time is shared by stride scheduling, first between
+// processes and then between the threads of each process: the
+// time a thread runs, measured to 1/TICKFRAC of a tick each time
+// it leaves the CPU, advances the pass of both the thread and its
+// process by a stride inversely proportional to their tickets, and
+// a CPU runs the queued thread of the process with the lowest
+// pass, and of its threads the one with the lowest pass, oldest
+// first. Processes thus get CPU in proportion to their tickets,
+// however many threads they have, and so do threads within one.
+//
+// Processes with deadlines (see set_deadline) are scheduled
+// earliest deadline first ahead of all others. Each one has a
+// reservation of runtime ticks every period on one CPU, admitted
+// only while the reservations on that CPU add up to no more than
+// the whole CPU. Every period releases a job, which must finish,
+// by putting all of the process's threads to sleep, within
+// deadline ticks. Until it does, or uses up its runtime, its
+// threads run before any other thread on their CPU, and the
+// earliest deadline goes first. A process past its runtime or
+// done with its job is scheduled by stride until the next period.
+struct runq {
+  struct spinlock lock;
+  struct thread *head;
+  struct thread *tail;
+  volatile int len;
+  uint minpass;                // See setrunnable
+};
+
+static struct runq runq[NCPU];
+
+// SLEEPING threads, hashed by the channel they sleep on, so that
+// wakeup() only looks at threads that may be waiting for it.
+// A thread is on its channel's queue exactly while it is SLEEPING.
+// Lock order: p->lock, then waitq lock; wakeup() drops the waitq
+// lock before it takes the lock of a waiter's process.
+struct waitq {
+  struct spinlock lock;
+  struct thread *head;
+  uint seq;                    // Sleeps on this queue so far
+};
+
+static struct waitq waitq[NWAITHASH];
+
+// Sum of the EDF reservations on each CPU, in RTUNITs.
+static uint rtutil[NCPU];
+
 static struct proc *initproc;
 
 int nextpid = 1;
-uint ret[NTHRD];
 extern void forkret(void);
 extern void trapret(void);
 
-static void wakeup1(void *chan);
+static int wakeupthreads(struct proc *p, void *chan, int n);
+static void rtunreserve(struct proc *p);
 
 void
 pinit(void)
 {
+  int i;
+
   initlock(&ptable.lock, "ptable");
+  initlock(&ptable.waitlock, "waitlock");
+  for(i = 0; i < NPROC; i++)
+    initlock(&ptable.proc[i].lock, "proc");
+  for(i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(i = 0; i < NWAITHASH; i++)
+    initlock(&waitq[i].lock, "waitq");
 }
 
 // Must be called with interrupts disabled
@@ -66,35 +141,70 @@ myproc(void) {
   return p;
 }
 
+// Disable interrupts so that we are not rescheduled
+// while reading thread from the cpu structure
+struct thread*
+mythread(void) {
+  struct cpu *c;
+  struct thread *t;
+  pushcli();
+  c = mycpu();
+  t = c->thread;
+  popcli();
+  return t;
+}
+
+static struct thread**
+tidbucket(struct proc *p, thread_t tid)
+{
+  return &p->tidhash[tid % NTIDHASH];
+}
+
+// Look up the thread of p with the given tid.
 // need to acquire lock before call this function.
 static struct thread*
-allocthread(struct proc *p, thread_t tid){
+findthread(struct proc *p, thread_t tid)
+{
   struct thread *t;
-  char *sp;
 
-  for(t = p->t; t < &p->t[NTHRD]; t++){
-    if(t->state != UNUSED && t->tid == tid){
-      cprintf("thread allocation error: pid %d tid %d duplicate\n", p->pid, t->tid);
-      return 0;
-    }
-  }
+  for(t = *tidbucket(p, tid); t; t = t->hnext)
+    if(t->tid == tid)
+      return t;
+  return 0;
+}
 
-  for(t = p->t; t < &p->t[NTHRD]; t++)
-    if(t->state == UNUSED)
-      goto found;
+// need to acquire lock before call this function.
+static struct thread*
+allocthread(struct proc *p, thread_t tid){
+  struct thread *t;
+  char *page, *sp;
 
-  return 0;
+  if(findthread(p, tid) != 0){
+    cprintf("thread allocation error: pid %d tid %d duplicate\n", p->pid, tid);
+    return 0;
+  }
 
-found:
+  // Allocate kernel stack, with the descriptor at its bottom.
+  if((page = kalloc()) == 0)
+    return 0;
+  t = (struct thread*)page;
+  memset(t, 0, sizeof *t);
+  t->kstack = page;
   t->state = EMBRYO;
   t->tid = tid;
+  t->proc = p;
+  t->cpu = cpuid();
+  t->affinity = ALLCPUS;
+  t->tickets = DEFTICKETS;
+  t->pass = p->tpass;
+
+  t->tnext = p->threads;
+  if(p->threads)
+    p->threads->tprev = t;
+  p->threads = t;
+  t->hnext = *tidbucket(p, tid);
+  *tidbucket(p, tid) = t;
 
-  // Allocate kernel stack.
-  if((t->kstack = kalloc()) == 0){
-    t->state = UNUSED;
-    t->tid = 0;
-    return 0;
-  }
   sp = t->kstack + KSTACKSIZE;
 
   // Leave room for trap frame.
@@ -115,10 +225,486 @@ found:
   return t;
 } 
 
+// Unlink t from its process and the tid hash and free it
+// together with its kernel stack.
+// need to acquire lock before call this function.
+static void
+freethread(struct thread *t)
+{
+  struct proc *p = t->proc;
+  struct thread **pp;
+
+  for(pp = tidbucket(p, t->tid); *pp != t; pp = &(*pp)->hnext)
+    ;
+  *pp = t->hnext;
+  if(t->tprev)
+    t->tprev->tnext = t->tnext;
+  else
+    p->threads = t->tnext;
+  if(t->tnext)
+    t->tnext->tprev = t->tprev;
+  kfree(t->kstack);
+}
+
+// Remember the user stack with top ustack for reuse by
+// thread_create(). Stacks that don't fit are not reused.
+// need to acquire lock before call this function.
+static void
+pushfreestack(struct proc *p, uint ustack)
+{
+  if(p->freestack == 0 && (p->freestack = (uint*)kalloc()) == 0)
+    return;
+  if(p->nfreestack < PGSIZE / sizeof(uint))
+    p->freestack[p->nfreestack++] = ustack;
+}
+
+// Would mapping a page of its own at va put p over its memory
+// limit? Only resident pages count against the limit.
+// need to acquire lock before call this function.
+static int
+overlimit(struct proc *p, uint va)
+{
+  if(p->memlimit == 0 || countuvm(p->pgdir, va, va + 1) != 0)
+    return 0;
+  return (countuvm(p->pgdir, 0, p->sz) + 1) * PGSIZE > p->memlimit;
+}
+
+// Append t to the run queue of its CPU.
+static void
+runqput(struct thread *t)
+{
+  struct runq *rq = &runq[t->cpu];
+
+  acquire(&rq->lock);
+  t->next = 0;
+  if(rq->tail)
+    rq->tail->next = t;
+  else
+    rq->head = t;
+  rq->tail = t;
+  rq->len++;
+  release(&rq->lock);
+}
+
+// May t run on the given CPU? A process with a deadline runs
+// only on the CPU it has its reservation on.
+static int
+allowed(struct thread *t, int cpu)
+{
+  if(t->proc->period && cpu != t->proc->rtcpu)
+    return 0;
+  return (t->affinity & t->proc->affinity) & (1 << cpu);
+}
+
+// Has p, a process with a deadline, a job to run: the current
+// one, if it is not done and has runtime left, or the one
+// released since? If so, set *dl to the job's deadline.
+// Reads p without its lock; the answer only needs to be
+// roughly right.
+static int
+rtjob(struct proc *p, uint *dl)
+{
+  uint start, period;
+
+  if((period = p->period) == 0)
+    return 0;
+  start = p->jobstart;
+  if(ticks - start >= period)
+    start += (ticks - start) / period * period;
+  else if(p->jobdone || p->budget == 0)
+    return 0;
+  *dl = start + p->deadline;
+  return 1;
+}
+
+// Release p's next job if a period has passed since the current
+// one was released. A job not done by then missed its deadline.
+// Caller must hold p->lock.
+static void
+rtupdate(struct proc *p)
+{
+  if(p->period == 0 || ticks - p->jobstart < p->period)
+    return;
+  if(!p->jobdone)
+    p->nmiss++;
+  p->jobstart += (ticks - p->jobstart) / p->period * p->period;
+  p->budget = p->runtime;
+  p->jobdone = 0;
+}
+
+// Are all of p's threads asleep? Caller must hold p->lock.
+static int
+allasleep(struct proc *p)
+{
+  struct thread *t;
+
+  for(t = p->threads; t; t = t->tnext)
+    if(t->state == RUNNABLE || t->state == RUNNING)
+      return 0;
+  return 1;
+}
+
+// Should t run before u? A thread with an EDF job to run goes
+// first, the earliest deadline first. Otherwise the thread of the
+// process with the lower pass goes first, and between threads of
+// one process the one with the lower pass. trt and tdl are what
+// rtjob() says about t's process, urt and udl about u's.
+static int
+before(struct thread *t, int trt, uint tdl,
+       struct thread *u, int urt, uint udl)
+{
+  if(trt != urt)
+    return trt;
+  if(trt && t->proc != u->proc)
+    return (int)(tdl - udl) < 0;
+  if(t->proc != u->proc)
+    return (int)(t->proc->pass - u->proc->pass) < 0;
+  return (int)(t->pass - u->pass) < 0;
+}
+
+// Remove and return the next thread to run from rq, or 0: the
+// oldest one of those that should run first (see before()).
+// If p is non-zero, only take it if it is a thread of p.
+// If cpu is not -1, only consider threads that may run on cpu.
+// The order depends on passes and deadlines that change while
+// threads wait, so the queue stays in arrival order and picking
+// scans all of it: O(n) in the queue length, not O(1) as when it
+// was plain FIFO. Queues are short, one per CPU.
+static struct thread*
+runqget(struct runq *rq, struct proc *p, int cpu)
+{
+  struct thread *t, *prev, *best, *bestprev;
+  uint dl, bestdl;
+  int rt, bestrt;
+
+  if(rq->len == 0)
+    return 0;
+  acquire(&rq->lock);
+  best = bestprev = 0;
+  bestrt = 0;
+  bestdl = 0;
+  for(prev = 0, t = rq->head; t; prev = t, t = t->next){
+    if(cpu != -1 && !allowed(t, cpu))
+      continue;
+    dl = 0;
+    rt = rtjob(t->proc, &dl);
+    if(best == 0 || before(t, rt, dl, best, bestrt, bestdl)){
+      best = t;
+      bestprev = prev;
+      bestrt = rt;
+      bestdl = dl;
+    }
+  }
+  if((t = best) != 0 && (p == 0 || t->proc == p)){
+    if(bestprev)
+      bestprev->next = t->next;
+    else
+      rq->head = t->next;
+    if(rq->tail == t)
+      rq->tail = bestprev;
+    t->next = 0;
+    rq->len--;
+  } else
+    t = 0;
+  release(&rq->lock);
+  return t;
+}
+
+// Pick the next thread for the current CPU: from its own
+// queue, or else steal one from the busiest other CPU, as long
+// as its affinity lets it run here.
+// Must be called with interrupts disabled.
+static struct thread*
+pickthread(void)
+{
+  struct runq *rq, *mine, *victim;
+  struct thread *t;
+
+  mine = &runq[cpuid()];
+  if((t = runqget(mine, 0, -1)) != 0)
+    return t;
+
+  victim = 0;
+  for(rq = runq; rq < &runq[ncpu]; rq++)
+    if(rq != mine && rq->len > 0 && (victim == 0 || rq->len > victim->len))
+      victim = rq;
+  if(victim == 0 || (t = runqget(victim, 0, mine - runq)) == 0)
+    return 0;
+  t->cpu = mine - runq;
+  return t;
+}
+
+// The CPU with the shortest run queue among those t may run on.
+static int
+pickcpu(struct thread *t)
+{
+  int i, best;
+
+  best = -1;
+  for(i = 0; i < ncpu; i++)
+    if(allowed(t, i) && (best < 0 || runq[i].len < runq[best].len))
+      best = i;
+  return best < 0 ? t->cpu : best;
+}
+
+// If the next thread on the current CPU's run queue belongs
+// to p, take it; see scheduler().
+// Caller must hold p->lock.
+static struct thread*
+runqgetsibling(struct proc *p)
+{
+  if(p->frozen)
+    return 0;
+  return runqget(&runq[cpuid()], p, -1);
+}
+
+// Wake a CPU halted in scheduler() to run t, just queued on its
+// CPU's run queue: that CPU if it is idle, or else any idle CPU
+// t may run on, which will steal it.
+// Must be called with interrupts disabled.
+static void
+kickidle(struct thread *t)
+{
+  struct cpu *c;
+
+  if(xchg(&cpus[t->cpu].idle, 0)){
+    lapicipi(cpus[t->cpu].apicid, T_IRQ0 + IRQ_WAKEUP);
+    return;
+  }
+  // A TICKLESS CPU that was running a thread alone has no
+  // timer armed to preempt it; see armtimer().
+  if(TICKLESS && !cpus[t->cpu].sliced){
+    if(t->cpu == cpuid())
+      armtimer();
+    else
+      lapicipi(cpus[t->cpu].apicid, T_IRQ0 + IRQ_WAKEUP);
+  }
+  for(c = cpus; c < &cpus[ncpu]; c++){
+    if(c->idle && allowed(t, c - cpus) && xchg(&c->idle, 0)){
+      lapicipi(c->apicid, T_IRQ0 + IRQ_WAKEUP);
+      return;
+    }
+  }
+}
+
+// Make cpu preempt its running thread for an EDF job just
+// queued there (see trap), instead of at the end of its slice.
+// Must be called with interrupts disabled.
+static void
+rtkick(int cpu)
+{
+  cpus[cpu].preempt = 1;
+  if(cpu != cpuid())
+    lapicipi(cpus[cpu].apicid, T_IRQ0 + IRQ_WAKEUP);
+}
+
+// Has an EDF job been queued on this CPU to preempt the running
+// thread since it last asked? Called by trap().
+int
+rtpreempt(void)
+{
+  int r;
+
+  pushcli();
+  r = xchg(&mycpu()->preempt, 0);
+  popcli();
+  return r;
+}
+
+// In TICKLESS mode, program this CPU's timer for its next event:
+// the end of the time slice if other threads are waiting on its
+// run queue, or the running thread may no longer run here or must
+// stop (see kickthreads); on CPU 0 also the next timer to expire.
+// A CPU that is idle or runs a thread alone gets no timer
+// interrupts.
+// Must be called with interrupts disabled.
+void
+armtimer(void)
+{
+  struct cpu *c = mycpu();
+  uint n, m;
+
+  if(!TICKLESS)
+    return;
+  // Clear sliced before looking at the queue, so that a thread
+  // queued meanwhile is either seen here or kicks us (kickidle).
+  xchg(&c->sliced, 0);
+  n = 0;
+  if(runq[cpuid()].len > 0 ||
+     (c->thread && (!allowed(c->thread, cpuid()) || c->thread->killed ||
+                    c->thread->proc->killed || c->thread->proc->frozen))){
+    n = TICKFRAC;
+    c->sliced = 1;
+  }
+  if(cpuid() == 0){
+    m = nexttick();
+    if(n == 0 || m < n)
+      n = m;
+  }
+  lapiconeshot(n);
+}
+
+static struct waitq*
+waitbucket(void *chan)
+{
+  uint h = (uint)chan >> 2;
+
+  h ^= (h >> 6) ^ (h >> 12);
+  return &waitq[h % NWAITHASH];
+}
+
+// Put t, about to sleep on t->chan, on the channel's wait queue.
+// Caller must hold t->proc->lock.
+static void
+waitqput(struct thread *t)
+{
+  struct waitq *wq = waitbucket(t->chan);
+
+  acquire(&wq->lock);
+  t->wseq = ++wq->seq;
+  t->wprev = 0;
+  t->wnext = wq->head;
+  if(wq->head)
+    wq->head->wprev = t;
+  wq->head = t;
+  release(&wq->lock);
+}
+
+// Take the SLEEPING thread t off its channel's wait queue.
+// Caller must hold t->proc->lock.
+static void
+waitqremove(struct thread *t)
+{
+  struct waitq *wq = waitbucket(t->chan);
+
+  acquire(&wq->lock);
+  if(t->wprev)
+    t->wprev->wnext = t->wnext;
+  else
+    wq->head = t->wnext;
+  if(t->wnext)
+    t->wnext->wprev = t->wprev;
+  release(&wq->lock);
+}
+
+// Mark t RUNNABLE and queue it for scheduling.
+// Each run queue's minpass is the pass of the process most
+// recently picked from it. A process that wakes up after
+// sleeping starts at most one tick's stride below the minpass
+// of its CPU, so that it does not monopolize the CPU with the
+// credit it saved up but keeps what it is owed for a slice that
+// another ran over. One moved to another CPU is brought to
+// within that stride below the minpass there, not above it:
+// passes on different CPUs grow apart, each at the pace of what
+// runs there. p->tpass does the same for the threads of p.
+// Caller must hold t->proc->lock.
+static void
+setrunnable(struct thread *t)
+{
+  uint dl, floor;
+  int fresh, moved;
+
+  rtupdate(t->proc);
+  // A thread that yields is no new work for idle CPUs,
+  // unless its affinity now sends it elsewhere.
+  fresh = t->state != RUNNING;
+  moved = 0;
+  if(!allowed(t, t->cpu)){
+    t->cpu = pickcpu(t);
+    fresh = moved = 1;
+  }
+  if(moved && (int)(t->proc->pass - runq[t->cpu].minpass) > 0)
+    t->proc->pass = runq[t->cpu].minpass;
+  if(t->state == SLEEPING || moved){
+    floor = runq[t->cpu].minpass - STRIDE1 / t->proc->tickets;
+    if((int)(t->proc->pass - floor) < 0)
+      t->proc->pass = floor;
+  }
+  if(t->state == SLEEPING){
+    waitqremove(t);
+    t->proc->nsleeping--;
+    floor = t->proc->tpass - STRIDE1 / t->tickets;
+    if((int)(t->pass - floor) < 0)
+      t->pass = floor;
+  }
+  t->state = RUNNABLE;
+  t->readysince = ticks;
+  runqput(t);
+  if(fresh){
+    kickidle(t);
+    if(rtjob(t->proc, &dl))
+      rtkick(t->cpu);
+  }
+}
+
+// Mark t RUNNING on this CPU and account for its time in the
+// run queue. Caller must hold t->proc->lock. minpass is
+// updated without the run queue's lock; it only needs to be
+// roughly right.
+static void
+startrunning(struct thread *t)
+{
+  struct runq *rq;
+
+  rtupdate(t->proc);
+  t->state = RUNNING;
+  t->lastcpu = cpuid();
+  rq = &runq[cpuid()];
+  if((int)(t->proc->pass - rq->minpass) > 0)
+    rq->minpass = t->proc->pass;
+  if((int)(t->pass - t->proc->tpass) > 0)
+    t->proc->tpass = t->pass;
+  t->runstart = ticks;
+  t->runclock = clocknow();
+  t->waitticks += t->runstart - t->readysince;
+}
+
+// Make cpu, which runs a thread that must leave it, arm its
+// timer for the end of the slice (see armtimer). A TICKLESS CPU
+// running a thread alone would otherwise never enter the kernel.
+// Must be called with interrupts disabled.
+static void
+kickcpu(int cpu)
+{
+  if(!TICKLESS)
+    return;
+  if(cpu == cpuid())
+    armtimer();
+  else
+    lapicipi(cpus[cpu].apicid, T_IRQ0 + IRQ_WAKEUP);
+}
+
+// Make the CPUs running threads of p that may no longer run
+// there preempt them, so that they move.
+// Caller must hold p->lock.
+static void
+moveoff(struct proc *p)
+{
+  struct thread *t;
+
+  for(t = p->threads; t; t = t->tnext)
+    if(t->state == RUNNING && !allowed(t, t->lastcpu))
+      kickcpu(t->lastcpu);
+}
+
+// Bring the threads of p running on other CPUs into the kernel,
+// to see that they were killed or must leave the CPU (freeze).
+// Caller must hold p->lock.
+static void
+kickthreads(struct proc *p)
+{
+  struct thread *t;
+
+  for(t = p->threads; t; t = t->tnext)
+    if(t->state == RUNNING && t != mythread())
+      kickcpu(t->lastcpu);
+}
+
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
-// state required to run in the kernel.
+// state required to run in the kernel; its first
+// thread is p->threads.
 // Otherwise return 0.
 static struct proc*
 allocproc(void)
@@ -126,28 +712,41 @@ allocproc(void)
   struct proc *p;
   struct thread *t;
 
-  acquire(&ptable.lock);
-
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    // Look before locking: a process may hold its lock for
+    // long, as fork() does while it copies the address space.
+    if(p->state != UNUSED)
+      continue;
+    acquire(&p->lock);
     if(p->state == UNUSED)
       goto found;
-
-  release(&ptable.lock);
+    release(&p->lock);
+  }
   return 0;
 
 found:
   p->state = EMBRYO;
+  acquire(&ptable.lock);
   p->pid = nextpid++;
+  release(&ptable.lock);
+  p->threads = 0;
+  p->nfreestack = 0;
+  p->affinity = ALLCPUS;
+  p->tickets = DEFTICKETS;
+  p->pass = runq[cpuid()].minpass;  // first queued on this CPU
+  p->tpass = 0;
+  p->period = 0;
+  p->nmiss = 0;
+  p->cow = 0;
 
   if ((t = allocthread(p, 1)) == 0){
     p->state = UNUSED;
     p->pid = 0;
-    p = 0;
+    release(&p->lock);
+    return 0;
   };
 
-  p->tidx = t - p->t;
-
-  release(&ptable.lock);
+  release(&p->lock);
   return p;
 }
 
@@ -157,9 +756,11 @@ void
 userinit(void)
 {
   struct proc *p;
+  struct thread *t;
   extern char _binary_initcode_start[], _binary_initcode_size[];
 
   p = allocproc();
+  t = p->threads;
   
   initproc = p;
   if((p->pgdir = setupkvm()) == 0)
@@ -167,14 +768,14 @@ userinit(void)
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
   p->sz = PGSIZE;
 
-  memset(p->t[p->tidx].tf, 0, sizeof(*p->t[p->tidx].tf));
-  p->t[p->tidx].tf->cs = (SEG_UCODE << 3) | DPL_USER;
-  p->t[p->tidx].tf->ds = (SEG_UDATA << 3) | DPL_USER;
-  p->t[p->tidx].tf->es = p->t[p->tidx].tf->ds;
-  p->t[p->tidx].tf->ss = p->t[p->tidx].tf->ds;
-  p->t[p->tidx].tf->eflags = FL_IF;
-  p->t[p->tidx].tf->esp = PGSIZE;
-  p->t[p->tidx].tf->eip = 0;  // beginning of initcode.S
+  memset(t->tf, 0, sizeof(*t->tf));
+  t->tf->cs = (SEG_UCODE << 3) | DPL_USER;
+  t->tf->ds = (SEG_UDATA << 3) | DPL_USER;
+  t->tf->es = t->tf->ds;
+  t->tf->ss = t->tf->ds;
+  t->tf->eflags = FL_IF;
+  t->tf->esp = PGSIZE;
+  t->tf->eip = 0;  // beginning of initcode.S
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
@@ -183,12 +784,102 @@ userinit(void)
   // run this process. the acquire forces the above
   // writes to be visible, and the lock is also needed
   // because the assignment might not be atomic.
-  acquire(&ptable.lock);
+  acquire(&p->lock);
 
   p->state = RUNNABLE;
-  p->t[p->tidx].state = RUNNABLE;
+  setrunnable(t);
 
-  release(&ptable.lock);
+  release(&p->lock);
+}
+
+// Keep p's threads off every CPU but the caller's: wait until
+// no other CPU is running p and make the scheduler pass p over
+// until thaw(). A CPU that runs p again reloads %cr3 in
+// switchuvm(), so no CPU keeps stale TLB entries for pages
+// unmapped from p->pgdir in between.
+// Caller must hold p->lock.
+static void
+freeze(struct proc *p)
+{
+  struct cpu *c;
+
+  // Another thread of p is already freezing it; that thread waits
+  // for us to leave the CPU, so get out of its way.
+  while(p->frozen)
+    sleep(&p->frozen, &p->lock);
+  p->frozen = 1;
+  kickthreads(p);
+
+  // Keep interrupts off while dropping the lock so that this
+  // thread is not itself preempted and left unschedulable.
+  pushcli();
+  for(c = cpus; c < cpus+ncpu; c++){
+    while(c != mycpu() && c->proc == p){
+      release(&p->lock);
+      acquire(&p->lock);
+    }
+  }
+  popcli();
+}
+
+static void
+thaw(struct proc *p)
+{
+  p->frozen = 0;
+  wakeupthreads(p, &p->frozen, -1);
+}
+
+// Make every thread of p other than curthread exit, wait until
+// none of them is left on a CPU, and free their kernel stacks.
+// The threads notice t->killed on their way back to user space
+// or in the killed checks of sleeping loops.
+// Caller must hold p->lock.
+static void
+stopthreads(struct proc *p, struct thread *curthread)
+{
+  struct thread *t, *nt;
+  int alive;
+
+  for(;;){
+    alive = 0;
+    for(t = p->threads; t; t = t->tnext){
+      if(t == curthread || t->state == ZOMBIE)
+        continue;
+      alive = 1;
+      t->killed = 1;
+      if(t->state == SLEEPING)
+        setrunnable(t);
+    }
+    if(!alive)
+      break;
+    kickthreads(p);
+    // Woken by the exiting threads (see exit and thread_exit).
+    sleep(p, &p->lock);
+  }
+
+  for(t = p->threads; t; t = nt){
+    nt = t->tnext;
+    if(t != curthread)
+      freethread(t);
+  }
+}
+
+// Stop the other threads of the current process before exec()
+// replaces its address space. Returns -1 if this thread was
+// itself told to exit by another thread's exit() or exec().
+int
+killsiblings(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&p->lock);
+  if(mythread()->killed){
+    release(&p->lock);
+    return -1;
+  }
+  stopthreads(p, mythread());
+  release(&p->lock);
+  return 0;
 }
 
 // Grow current process's memory by n bytes.
@@ -196,23 +887,37 @@ userinit(void)
 int
 growproc(int n)
 {
+  int i;
   uint sz;
   struct proc *curproc = myproc();
 
+  // Threads share curproc->sz and the page table.
+  acquire(&curproc->lock);
   sz = curproc->sz;
-  if (curproc->memlimit != 0 && curproc->sz + n > curproc->memlimit){
-    cprintf("memory limit exceeded\n");
-    return -1;
-  }
-  
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Pages are mapped on first touch (see pagefault), and count
+    // against the memory limit only then.
+    if(sz + n >= KERNBASE || sz + n < sz){
+      release(&curproc->lock);
       return -1;
+    }
+    sz += n;
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Other CPUs must not reach the freed pages through their TLBs.
+    freeze(curproc);
+    sz = deallocuvm(curproc->pgdir, sz, sz + n);
+    thaw(curproc);
+    if(sz == 0){
+      release(&curproc->lock);
       return -1;
+    }
+    // Memory grown back later reads as zeros, not from the file.
+    for(i = 0; i < NSEG; i++)
+      if(curproc->seg[i].end > sz)
+        curproc->seg[i].end = sz > curproc->seg[i].va ? sz : curproc->seg[i].va;
   }
   curproc->sz = sz;
+  release(&curproc->lock);
   switchuvm(curproc);
   return 0;
 }
@@ -223,45 +928,70 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int i, pid, cow;
   struct proc *np;
+  struct thread *nt, *t;
   struct proc *curproc = myproc();
+  struct thread *curthread = mythread();
 
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
-  // cprintf("\nFORK %d %d --- %d %d\n", curproc->pid, curproc->t[curproc->tidx].tid, np->pid, np->t[np->tidx].tid);
-
-  // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+  nt = np->threads;
+
+  // Copy process state from proc. Other threads may be
+  // changing the address space at the same time. No one else
+  // touches np while it is an EMBRYO.
+  // A single-threaded parent shares its pages with the child
+  // copy-on-write. Breaking the sharing changes a mapping without
+  // telling other CPUs, so only single-threaded processes may
+  // share pages (thread_create() unshares them first); a parent
+  // with other threads copies everything now.
+  acquire(&curproc->lock);
+  cow = 1;
+  for(t = curproc->threads; t; t = t->tnext)
+    if(t != curthread && t->state != ZOMBIE)
+      cow = 0;
+  if(cow)
+    curproc->cow = 1;
+  np->cow = 1;
+  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz, cow)) == 0){
+    release(&curproc->lock);
+    acquire(&np->lock);
+    freethread(nt);
+    np->threads = 0;
     np->state = UNUSED;
-    kfree(np->t[np->tidx].kstack);
-    np->t[np->tidx].kstack = 0;
-    np->t[np->tidx].state = UNUSED;
-    np->t[np->tidx].tid = 0;
+    release(&np->lock);
     return -1;
   }
 
   np->sz = curproc->sz;
+  for(i = 0; i < NSEG; i++)
+    if((np->seg[i] = curproc->seg[i]).ip){
+      idup(np->seg[i].ip);
+      iexec(np->seg[i].ip, 1);
+    }
   np->stacksize = curproc->stacksize;
   np->memlimit = curproc->memlimit;
-  np->parent = curproc;
-  for (i = 0; i < NTHRD; i++){
-    if (i == np->tidx) np->ustack[i] = curproc->ustack[curproc->tidx];
-    else if (i == curproc->tidx){
-      if (curproc->ustack[np->tidx] != 0) np->emptystack[i] = curproc->ustack[np->tidx];
-      else np->emptystack[i] = curproc->emptystack[np->tidx];
-    }
-    else {
-      if (curproc->ustack[i] != 0 && i != curproc->tidx) np->emptystack[i] = curproc->ustack[i];
-      else np->emptystack[i] = curproc->emptystack[i];
-    }
-  }
-  *np->t[np->tidx].tf = *curproc->t[curproc->tidx].tf;
+  np->affinity = curproc->affinity;
+  np->tickets = curproc->tickets;
+  // The child runs on the calling thread's stack; the stacks of
+  // the other threads are free for its own thread_create()s.
+  nt->ustack = curthread->ustack;
+  nt->tls = curthread->tls;
+  nt->affinity = curthread->affinity;
+  nt->tickets = curthread->tickets;
+  for(i = 0; i < curproc->nfreestack; i++)
+    pushfreestack(np, curproc->freestack[i]);
+  for(t = curproc->threads; t; t = t->tnext)
+    if(t != curthread && t->ustack != 0)
+      pushfreestack(np, t->ustack);
+  release(&curproc->lock);
+  *nt->tf = *curthread->tf;
 
   // Clear %eax so that fork returns 0 in the child.
-  np->t[np->tidx].tf->eax = 0;
+  nt->tf->eax = 0;
 
   for(i = 0; i < NOFILE; i++)
     if(curproc->ofile[i])
@@ -272,12 +1002,106 @@ fork(void)
 
   pid = np->pid;
 
-  acquire(&ptable.lock);
+  acquire(&ptable.waitlock);
+  np->parent = curproc;
+  release(&ptable.waitlock);
+
+  acquire(&np->lock);
 
   np->state = RUNNABLE;
-  np->t[np->tidx].state = RUNNABLE;
+  setrunnable(nt);
 
-  release(&ptable.lock);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a new process running the ELF file path, as fork() and
+// exec2() would but without copying the caller's memory first.
+// The child's file descriptor i is the caller's fds[i], or is
+// closed if fds[i] < 0, for i < nfd; with fds == 0 the child gets
+// all of the caller's open files. Returns the child's pid.
+int
+spawn(char *path, char **argv, int stacksize, int *fds, int nfd)
+{
+  int i, pid;
+  uint sz, sp, entry;
+  char *s, *last;
+  pde_t *pgdir;
+  struct segment seg[NSEG];
+  struct proc *np;
+  struct thread *nt;
+  struct proc *curproc = myproc();
+  struct thread *curthread = mythread();
+
+  if(fds){
+    for(i = 0; i < nfd; i++)
+      if(fds[i] >= NOFILE || (fds[i] >= 0 && curproc->ofile[fds[i]] == 0))
+        return -1;
+  }
+
+  if(loadimage(path, argv, stacksize, &pgdir, &sz, &sp, &entry, seg) < 0)
+    return -1;
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    freevm(pgdir);
+    putsegs(seg);
+    return -1;
+  }
+  nt = np->threads;
+
+  np->pgdir = pgdir;
+  memmove(np->seg, seg, sizeof(seg));
+  np->cow = 1;
+  np->sz = sz;
+  np->stacksize = stacksize;
+  acquire(&curproc->lock);
+  np->memlimit = curproc->memlimit;
+  np->affinity = curproc->affinity;
+  np->tickets = curproc->tickets;
+  nt->affinity = curthread->affinity;
+  nt->tickets = curthread->tickets;
+  release(&curproc->lock);
+  nt->ustack = sz;
+
+  memset(nt->tf, 0, sizeof(*nt->tf));
+  nt->tf->cs = (SEG_UCODE << 3) | DPL_USER;
+  nt->tf->ds = (SEG_UDATA << 3) | DPL_USER;
+  nt->tf->es = nt->tf->ds;
+  nt->tf->ss = nt->tf->ds;
+  nt->tf->eflags = FL_IF;
+  nt->tf->esp = sp;
+  nt->tf->eip = entry;  // main
+
+  if(fds){
+    for(i = 0; i < nfd; i++)
+      if(fds[i] >= 0)
+        np->ofile[i] = filedup(curproc->ofile[fds[i]]);
+  } else {
+    for(i = 0; i < NOFILE; i++)
+      if(curproc->ofile[i])
+        np->ofile[i] = filedup(curproc->ofile[i]);
+  }
+  np->cwd = idup(curproc->cwd);
+
+  for(last=s=path; *s; s++)
+    if(*s == '/')
+      last = s+1;
+  safestrcpy(np->name, last, sizeof(np->name));
+
+  pid = np->pid;
+
+  acquire(&ptable.waitlock);
+  np->parent = curproc;
+  release(&ptable.waitlock);
+
+  acquire(&np->lock);
+
+  np->state = RUNNABLE;
+  setrunnable(nt);
+
+  release(&np->lock);
 
   return pid;
 }
@@ -289,12 +1113,25 @@ void
 exit(void)
 {
   struct proc *curproc = myproc();
+  struct thread *curthread = mythread();
   struct proc *p;
-  int fd;
+  int fd, orphans;
 
   if(curproc == initproc)
     panic("init exiting");
 
+  acquire(&curproc->lock);
+  if(curthread->killed){
+    // Another thread is already tearing the process down
+    // (see stopthreads); just stop this one.
+    curthread->state = ZOMBIE;
+    wakeupthreads(curproc, curproc, -1);
+    sched();
+    panic("zombie exit");
+  }
+  stopthreads(curproc, curthread);
+  release(&curproc->lock);
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
@@ -307,24 +1144,33 @@ exit(void)
   iput(curproc->cwd);
   end_op();
   curproc->cwd = 0;
+  putsegs(curproc->seg);
 
-  acquire(&ptable.lock);
+  acquire(&ptable.waitlock);
 
   // Parent might be sleeping in wait().
-  wakeup1(curproc->parent);
+  wakeup(curproc->parent);
 
   // Pass abandoned children to init.
+  orphans = 0;
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if(p->parent == curproc){
       p->parent = initproc;
-      if(p->state == ZOMBIE)
-        wakeup1(initproc);
+      orphans = 1;
     }
   }
+  if(orphans)
+    wakeup(initproc);
 
-  // Jump into the scheduler, never to return.
+  // Holding waitlock until curproc is a ZOMBIE keeps the parent
+  // from looking at it too early.
+  acquire(&curproc->lock);
+  rtunreserve(curproc);
   curproc->state = ZOMBIE;
-  curproc->t[curproc->tidx].state = RUNNABLE;
+  curthread->state = ZOMBIE;
+  release(&ptable.waitlock);
+
+  // Jump into the scheduler, never to return.
   sched();
   panic("zombie exit");
 }
@@ -335,11 +1181,10 @@ int
 wait(void)
 {
   struct proc *p;
-  struct thread *t;
   int havekids, pid;
   struct proc *curproc = myproc();
   
-  acquire(&ptable.lock);
+  acquire(&ptable.waitlock);
   for(;;){
     // Scan through table looking for exited children.
     havekids = 0;
@@ -347,6 +1192,9 @@ wait(void)
       if(p->parent != curproc)
         continue;
       havekids = 1;
+      // The child's last thread has left the CPU once its
+      // lock can be taken (see sched).
+      acquire(&p->lock);
       if(p->state == ZOMBIE){
         // Found one.
         pid = p->pid;
@@ -357,40 +1205,38 @@ wait(void)
         p->killed = 0;
         p->state = UNUSED;
         // Free all internal threads.
-        for (t = p->t; t < &p->t[NTHRD]; t++){
-          if(t->state != UNUSED){
-            kfree(t->kstack);
-            t->kstack = 0;
-            t->state = UNUSED;
-            t->tid = 0;
-            p->emptystack[t - p->t] = 0;
-            p->ustack[t - p->t] = 0;
-            p->waiting[t - p->t] = 0;
-          }
+        while(p->threads)
+          freethread(p->threads);
+        if(p->freestack){
+          kfree((char*)p->freestack);
+          p->freestack = 0;
         }
-        release(&ptable.lock);
+        p->nfreestack = 0;
+        release(&p->lock);
+        release(&ptable.waitlock);
         return pid;
       }
+      release(&p->lock);
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || curproc->killed){
-      release(&ptable.lock);
+    if(!havekids || curproc->killed || mythread()->killed){
+      release(&ptable.waitlock);
       return -1;
     }
 
-    // Wait for children to exit.  (See wakeup1 call in proc_exit.)
-    sleep(curproc, &ptable.lock);  //DOC: wait-sleep
+    // Wait for children to exit.  (See wakeup call in exit.)
+    sleep(curproc, &ptable.waitlock);  //DOC: wait-sleep
   }
 }
 
 //PAGEBREAK: 42
-// Per-CPU process scheduler.
+// Per-CPU thread scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run
-//  - swtch to start running that process
-//  - eventually that process transfers control
+//  - take a thread from this CPU's run queue (or steal one)
+//  - swtch to start running that thread
+//  - eventually that thread transfers control
 //      via swtch back to the scheduler.
 void
 scheduler(void)
@@ -399,49 +1245,91 @@ scheduler(void)
   struct thread *t;
   struct cpu *c = mycpu();
   c->proc = 0;
+  c->thread = 0;
   
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
-    // cnt = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE)
-        continue;
-
-      // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
-      // before jumping back to us.
-      for(t = p->t; t < &p->t[NTHRD] && p->state == RUNNABLE; t++){
-        if(t->state != RUNNABLE)
-          continue;
-        // Select one of the runnable thread and copy data.
-        p->tidx = t - p->t;
-
-        c->proc = p;
-        switchuvm(p);
-        p->state = RUNNING;
-        p->t[p->tidx].state = RUNNING;
-
-        // if (p->pid == 4 && p->killed == 1) {
-        //   cprintf("%d %d\n", p->pid, t->tid);
-        // }
-        swtch(&(c->scheduler), p->t[p->tidx].context);
-        switchkvm();
+    pushcli();
+    c->preempt = 0;  // Whatever was queued is looked at now.
+    if((t = pickthread()) == 0){
+      // Nothing to run: halt until an interrupt. Say so before
+      // looking once more, so that a thread queued in between is
+      // either found here or followed by a wakeup IPI.
+      xchg(&c->idle, 1);
+      if((t = pickthread()) == 0){
+        armtimer();
+        stihlt();
+        cli();
       }
+      c->idle = 0;
+    }
+    popcli();
+    if(t == 0)
+      continue;
 
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      c->proc = 0;
+    p = t->proc;
+    acquire(&p->lock);
+    if(t->state != RUNNABLE)
+      panic("scheduler: queued thread not runnable");
+    if(p->frozen){
+      // Leave it queued until growproc() thaws the process.
+      runqput(t);
+      release(&p->lock);
+      continue;
     }
-    release(&ptable.lock);
 
+    // Switch to chosen thread.  It is the thread's job
+    // to release p->lock and then reacquire it
+    // before jumping back to us. Other threads of the
+    // same process may be running on other CPUs.
+    c->proc = p;
+    c->thread = t;
+    switchuvm(p);
+    startrunning(t);
+    armtimer();
+
+    swtch(&(c->scheduler), t->context);
+
+    // While the next queued thread is another thread of p, run it
+    // on the page table that is already loaded: only the kernel
+    // stack used for traps and the TLS segment change, and the TLB
+    // stays warm.
+    while((t = runqgetsibling(p)) != 0){
+      if(t->state != RUNNABLE)
+        panic("scheduler: queued thread not runnable");
+      c->thread = t;
+      c->ts.esp0 = (uint)t->kstack + KSTACKSIZE;
+      c->gdt[SEG_UTLS] = SEG(STA_W, t->tls, 0xffffffff, DPL_USER);
+      startrunning(t);
+      armtimer();
+      swtch(&(c->scheduler), t->context);
+    }
+    switchkvm();
+
+    // Thread is done running for now.
+    // It should have changed its t->state before coming back.
+    c->proc = 0;
+    c->thread = 0;
+    release(&p->lock);
   }
 }
 
-// Enter scheduler.  Must hold only ptable.lock
+// Advance the passes of t and its process for running n
+// TICKFRAC-ths of a tick. Caller must hold t->proc->lock.
+static void
+charge(struct thread *t, uint n)
+{
+  uint ps, ts;
+
+  ps = STRIDE1 / t->proc->tickets;
+  ts = STRIDE1 / t->tickets;
+  t->proc->pass += n / TICKFRAC * ps + n % TICKFRAC * ps / TICKFRAC;
+  t->pass += n / TICKFRAC * ts + n % TICKFRAC * ts / TICKFRAC;
+}
+
+// Enter scheduler.  Must hold only the process's lock
 // and have changed proc->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
@@ -452,18 +1340,30 @@ void
 sched(void)
 {
   int intena;
-  struct proc *p = myproc();
+  struct thread *t = mythread();
+  struct proc *p = t->proc;
+  uint n;
 
-  if(!holding(&ptable.lock))
-    panic("sched ptable.lock");
+  if(!holding(&t->proc->lock))
+    panic("sched p->lock");
   if(mycpu()->ncli != 1)
     panic("sched locks");
-  if(p->state == RUNNING || p->t[p->tidx].state == RUNNING)
+  if(t->state == RUNNING)
     panic("sched running");
   if(readeflags()&FL_IF)
     panic("sched interruptible");
+  n = clocknow() - t->runclock;
+  charge(t, n);
+  n += t->runfrac;
+  t->runticks += n / TICKFRAC;
+  t->runfrac = n % TICKFRAC;
+  // Charge the EDF job for the ticks it ran since its release.
+  n = ticks - t->runstart;
+  if((int)(t->runstart - p->jobstart) < 0)
+    n = ticks - p->jobstart;
+  p->budget -= n < p->budget ? n : p->budget;
   intena = mycpu()->intena;
-  swtch(&p->t[p->tidx].context, mycpu()->scheduler);
+  swtch(&t->context, mycpu()->scheduler);
   mycpu()->intena = intena;
 }
 
@@ -472,11 +1372,13 @@ void
 yield(void)
 {
   struct proc *p = myproc();
-  acquire(&ptable.lock);  //DOC: yieldlock
-  p->state = RUNNABLE;
-  p->t[p->tidx].state = RUNNABLE;
+  struct thread *t = mythread();
+
+  acquire(&p->lock);  //DOC: yieldlock
+  t->nivswitch++;
+  setrunnable(t);
   sched();
-  release(&ptable.lock);
+  release(&p->lock);
 }
 
 // A fork child's very first scheduling by scheduler()
@@ -485,8 +1387,8 @@ void
 forkret(void)
 {
   static int first = 1;
-  // Still holding ptable.lock from scheduler.
-  release(&ptable.lock);
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
 
   if (first) {
     // Some initialization functions must be run in the context
@@ -505,65 +1407,115 @@ forkret(void)
 void
 sleep(void *chan, struct spinlock *lk)
 {
-  struct proc *p = myproc();
-  //if (p->pid == 3) cprintf("pid %d tid %d sleep\n", p->pid, p->t[p->tidx].tid);
+  struct thread *t = mythread();
+  struct proc *p;
   
-  if(p == 0)
+  if(t == 0)
     panic("sleep");
+  p = t->proc;
 
   if(lk == 0)
     panic("sleep without lk");
 
-  // Must acquire ptable.lock in order to
-  // change p->state and then call sched.
-  // Once we hold ptable.lock, we can be
+  // Must acquire p->lock in order to
+  // change t->state and then call sched.
+  // Once we hold p->lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup runs with ptable.lock locked),
-  // so it's okay to release lk.
-  if(lk != &ptable.lock){  //DOC: sleeplock0
-    acquire(&ptable.lock);  //DOC: sleeplock1
-    release(lk);
-  }
+  // (wakeup locks the process of each thread
+  // it finds on chan's wait queue), so it's okay
+  // to release lk once this thread is queued.
+  if(lk != &p->lock)  //DOC: sleeplock0
+    acquire(&p->lock);  //DOC: sleeplock1
   // Go to sleep.
-  p->t[p->tidx].chan = chan;
-  p->state = RUNNABLE;
-  p->t[p->tidx].state = SLEEPING;
+  t->chan = chan;
+  t->state = SLEEPING;
+  waitqput(t);
+  p->nsleeping++;
+  t->nvswitch++;
+  // The process's EDF job is done once it has nothing left to run.
+  if(p->period){
+    rtupdate(p);
+    if(!p->jobdone && allasleep(p)){
+      if((int)(ticks - (p->jobstart + p->deadline)) > 0)
+        p->nmiss++;
+      p->jobdone = 1;
+    }
+  }
+  if(lk != &p->lock)
+    release(lk);
   sched();
 
   // Tidy up.
-  p->t[p->tidx].chan = 0;
+  t->chan = 0;
 
   // Reacquire original lock.
-  if(lk != &ptable.lock){  //DOC: sleeplock2
-    release(&ptable.lock);
+  if(lk != &p->lock){  //DOC: sleeplock2
+    release(&p->lock);
     acquire(lk);
   }
 }
 
 //PAGEBREAK!
-// Wake up all processes sleeping on chan.
-// The ptable lock must be held.
-static void
-wakeup1(void *chan)
+// Wake up to n threads of p sleeping on chan, or all of them if
+// n < 0, and return how many were woken. p->lock must be held.
+static int
+wakeupthreads(struct proc *p, void *chan, int n)
 {
-  struct proc *p;
-  struct thread *t;
+  struct waitq *wq = waitbucket(chan);
+  struct thread *t, *woken, *next;
+  int cnt;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    for (t = p->t; t < &p->t[NTHRD]; t++){
-      if(t->state == SLEEPING && t->chan == chan)
-        t->state = RUNNABLE;
+  // Collect the waiters first, since setrunnable takes wq->lock.
+  // They stay SLEEPING while we hold p->lock, so t->next, which
+  // only a RUNNABLE thread uses, is free to link them.
+  woken = 0;
+  cnt = 0;
+  acquire(&wq->lock);
+  for(t = wq->head; t && cnt != n; t = t->wnext){
+    if(t->proc == p && t->chan == chan){
+      t->next = woken;
+      woken = t;
+      cnt++;
     }
   }
+  release(&wq->lock);
+
+  for(t = woken; t; t = next){
+    next = t->next;
+    setrunnable(t);
+  }
+  return cnt;
 }
 
-// Wake up all processes sleeping on chan.
+// Wake up all threads sleeping on chan.
+// Must not be called with any process's lock held.
 void
 wakeup(void *chan)
 {
-  acquire(&ptable.lock);
-  wakeup1(chan);
-  release(&ptable.lock);
+  struct waitq *wq = waitbucket(chan);
+  struct thread *t;
+  struct proc *p;
+  uint seq;
+
+  // Wake the waiters one process at a time. Only threads that
+  // were asleep when we started count, so that threads woken
+  // here and going back to sleep cannot keep us looping.
+  acquire(&wq->lock);
+  seq = wq->seq;
+  for(;;){
+    for(t = wq->head; t; t = t->wnext)
+      if(t->chan == chan && (int)(t->wseq - seq) <= 0)
+        break;
+    if(t == 0)
+      break;
+    p = t->proc;
+    release(&wq->lock);
+    acquire(&p->lock);
+    wakeupthreads(p, chan, -1);
+    release(&p->lock);
+    acquire(&wq->lock);
+  }
+  release(&wq->lock);
 }
 
 // Kill the process with the given pid.
@@ -575,92 +1527,278 @@ kill(int pid)
   struct proc *p;
   struct thread *t;
 
-  acquire(&ptable.lock);
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid != pid)  // see allocproc
+      continue;
+    acquire(&p->lock);
     if(p->pid == pid){
       p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      for (t = p->t; t < &(p->t[NTHRD]); t++){
+      // Wake threads from sleep if necessary.
+      for (t = p->threads; p->nsleeping > 0 && t; t = t->tnext){
         if (t->state == SLEEPING)
-          t->state = RUNNABLE;
+          setrunnable(t);
       }
-      release(&ptable.lock);
+      // Threads running in user space exit when they next trap.
+      kickthreads(p);
+      release(&p->lock);
       return 0;
     }
+    release(&p->lock);
   }
-  release(&ptable.lock);
   return -1;
 }
 
+// Find the live process with the given pid and return it
+// with its lock held, or 0.
+static struct proc*
+lockproc(int pid)
+{
+  struct proc *p;
+
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid != pid)  // see allocproc
+      continue;
+    acquire(&p->lock);
+    if(p->pid == pid && p->state == RUNNABLE)
+      return p;
+    release(&p->lock);
+  }
+  return 0;
+}
+
 int
 setmemorylimit(int pid, int limit)
 {
   struct proc *p;
+  int sz;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      if (limit == 0) {
-        p->memlimit = limit;
-        return 0;
-      } else if (limit < 0) {
-        cprintf("memory limit must be positive\n");
-        return -1;
-      }
-      else if (limit < p->sz) {
-        cprintf("memory limit can't be smaller than allocated size\n");
-        return -1;
-      }
-      p->memlimit = limit;
-      return 0;
-    }
+  if((p = lockproc(pid)) == 0)
+    return -1;
+  // Only resident pages count (see pagefault).
+  sz = countuvm(p->pgdir, 0, p->sz) * PGSIZE;
+  if (limit >= 0 && (limit == 0 || limit >= sz))
+    p->memlimit = limit;
+  release(&p->lock);
+
+  if (limit < 0) {
+    cprintf("memory limit must be positive\n");
+    return -1;
+  }
+  else if (limit != 0 && limit < sz) {
+    cprintf("memory limit can't be smaller than resident size\n");
+    return -1;
+  }
+  return 0;
+}
+
+// Restrict process pid to the CPUs in mask, or only its thread
+// tid if tid is not -1. A thread picks up the new mask the next
+// time it is queued. Fails if a thread would have no CPU left.
+int
+set_affinity(int pid, int tid, uint mask)
+{
+  struct proc *p;
+  struct thread *t;
+
+  mask &= (1 << ncpu) - 1;
+  if((p = lockproc(pid)) == 0)
+    return -1;
+  if(p->period && (mask & (1 << p->rtcpu)) == 0)
+    goto bad;
+  if(tid == -1){
+    for(t = p->threads; t; t = t->tnext)
+      if((t->affinity & mask) == 0)
+        goto bad;
+    p->affinity = mask;
+  } else {
+    if((t = findthread(p, tid)) == 0 || (p->affinity & mask) == 0)
+      goto bad;
+    t->affinity = mask;
   }
+  moveoff(p);
+  release(&p->lock);
+  return 0;
+
+bad:
+  release(&p->lock);
   return -1;
 }
 
+// Release p's EDF reservation, if it has one.
+// Caller must hold p->lock.
+static void
+rtunreserve(struct proc *p)
+{
+  if(p->period == 0)
+    return;
+  acquire(&ptable.lock);
+  rtutil[p->rtcpu] -= p->rtutil;
+  release(&ptable.lock);
+  p->period = 0;
+}
+
+// Schedule process pid earliest deadline first: every period
+// ticks it is to get runtime ticks of CPU within deadline ticks.
+// A period of 0 returns it to stride scheduling. Fails unless
+// runtime <= deadline <= period, or if no CPU its threads may
+// run on has that much of its time left unreserved, in which
+// case the process keeps its old reservation. Otherwise it is
+// moved to the least reserved CPU that does.
+int
+set_deadline(int pid, int period, int runtime, int deadline)
+{
+  struct proc *p;
+  struct thread *t;
+  uint util, mask;
+  int i, cpu;
+
+  if(period < 0 || period > MAXPERIOD ||
+     (period > 0 && (runtime < 1 || runtime > deadline || deadline > period)))
+    return -1;
+  // The first job is released now.
+  acquire(&tickslock);
+  clockupdate();
+  release(&tickslock);
+  if((p = lockproc(pid)) == 0)
+    return -1;
+  if(period == 0){
+    rtunreserve(p);
+    release(&p->lock);
+    return 0;
+  }
+
+  util = (runtime * RTUNIT + period - 1) / period;
+  mask = p->affinity;
+  for(t = p->threads; t; t = t->tnext)
+    mask &= t->affinity;
+  cpu = -1;
+  acquire(&ptable.lock);
+  if(p->period)
+    rtutil[p->rtcpu] -= p->rtutil;
+  for(i = 0; i < ncpu; i++)
+    if((mask & (1 << i)) && rtutil[i] + util <= RTUNIT &&
+       (cpu < 0 || rtutil[i] < rtutil[cpu]))
+      cpu = i;
+  if(cpu < 0){
+    if(p->period)
+      rtutil[p->rtcpu] += p->rtutil;
+    release(&ptable.lock);
+    release(&p->lock);
+    return -1;
+  }
+  rtutil[cpu] += util;
+  release(&ptable.lock);
+
+  p->period = period;
+  p->runtime = runtime;
+  p->deadline = deadline;
+  p->rtutil = util;
+  p->rtcpu = cpu;
+  p->jobstart = ticks;
+  p->budget = runtime;
+  p->jobdone = allasleep(p);
+  moveoff(p);
+  release(&p->lock);
+  return 0;
+}
+
+// Give process pid, or its thread tid if tid is not -1, n
+// tickets. Processes get CPU time in proportion to their
+// tickets, however many threads they have; a process's time
+// is divided among its threads in proportion to theirs.
+int
+set_tickets(int pid, int tid, int n)
+{
+  struct proc *p;
+  struct thread *t;
+
+  if(n < 1 || n > MAXTICKETS || (p = lockproc(pid)) == 0)
+    return -1;
+  if(tid == -1)
+    p->tickets = n;
+  else if((t = findthread(p, tid)) != 0)
+    t->tickets = n;
+  else {
+    release(&p->lock);
+    return -1;
+  }
+  release(&p->lock);
+  return 0;
+}
+
+// The CPUs process pid, or its thread tid if tid is not -1,
+// may run on, or -1.
+int
+get_affinity(int pid, int tid)
+{
+  struct proc *p;
+  struct thread *t;
+  int mask;
+
+  if((p = lockproc(pid)) == 0)
+    return -1;
+  mask = p->affinity & ((1 << ncpu) - 1);
+  if(tid != -1){
+    if((t = findthread(p, tid)) == 0)
+      mask = -1;
+    else
+      mask &= t->affinity;
+  }
+  release(&p->lock);
+  return mask;
+}
+
 // thread implementation
 
 int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg){
   struct proc *p = myproc();
   struct thread *nt;
-  uint sp, ustack[3+1];
-  int i;
+  uint sz, sp, ustack[3+1];
 
-  acquire(&ptable.lock);
+  // The lock is held throughout since other threads of p
+  // may be creating threads or resizing memory at the same time.
+  acquire(&p->lock);
 
   // Allocate thread and kernel stack.
   if((nt = allocthread(p, *thread)) == 0){
-    release(&ptable.lock);
+    release(&p->lock);
     return -1;
   }
-  release(&ptable.lock);
+
+  // Pages still shared copy-on-write since fork(), or backed by
+  // the zero page, must become private before a second thread
+  // can run.
+  if (p->cow){
+    if (unshareuvm(p->pgdir, p->sz) < 0)
+      goto bad;
+    p->cow = 0;
+  }
 
   // check if the empty user stack space already exists.
-  for (i = 0; i < NTHRD; i++)
-    if (p->emptystack[i] != 0) break;
-  if (p->emptystack[nt - p->t] != 0) i = nt - p->t;
-  
-  if (i != NTHRD){
+  if (p->nfreestack > 0){
     // write ustack location.
-    p->ustack[nt - p->t] = p->emptystack[i];
-    p->emptystack[i] = 0;
+    nt->ustack = p->freestack[--p->nfreestack];
   }else {
-    // test if the curproc will exceed the limit.
-    if (p->memlimit != 0 && PGROUNDUP(p->sz) + 2*(p->stacksize + 1) > p->memlimit){
-      cprintf("memory limit exceeded.\n");
+    // Reserve the user stack: an inaccessible guard page, then
+    // stacksize pages that pagefault() maps on first touch.
+    sz = PGROUNDUP(p->sz) + (p->stacksize + 1)*PGSIZE;
+    if (sz >= KERNBASE || guardpage(p->pgdir, PGROUNDUP(p->sz)) < 0)
       goto bad;
-    }
+    p->sz = sz;
 
-    // Allocate user stack.
-    p->sz = PGROUNDUP(p->sz);
-    if (((p->sz = allocuvm(p->pgdir, p->sz, p->sz + (p->stacksize + 1)*PGSIZE)) == 0))
-      goto bad;
+    nt->ustack = p->sz;
+  }
 
-    p->ustack[nt - p->t] = p->sz;
+  // The top page holds the arguments below.
+  // test if the curproc will exceed the limit.
+  if (overlimit(p, nt->ustack - PGSIZE)){
+    cprintf("memory limit exceeded.\n");
+    goto bad;
   }
+  if (demandpage(p->pgdir, nt->ustack - PGSIZE, 1) < 0)
+    goto bad;
 
-  sp = p->ustack[nt - p->t];
+  sp = nt->ustack;
 
   // fetch argument and stack
   ustack[3] = (uint)arg;
@@ -674,51 +1812,50 @@ int thread_create(thread_t *thread, void *(*start_routine)(void *), void *arg){
     goto bad;
 
   // copy trap frame
-  *nt->tf = *p->t[p->tidx].tf;
+  *nt->tf = *mythread()->tf;
 
   nt->tf->eip = (uint)start_routine;
   nt->tf->esp = sp;
+  // New threads start without a TLS block.
+  nt->tf->gs = 0;
+  nt->affinity = mythread()->affinity;
 
+  setrunnable(nt);
 
-  acquire(&ptable.lock);
-
-  nt->state = RUNNABLE;
-
-  release(&ptable.lock);
+  release(&p->lock);
   
   return 0;
 
   bad:
-    kfree(nt->kstack);
-    nt->kstack = 0;
-    nt->state = UNUSED;
-    nt->tid = 0;
+    if (nt->ustack != 0)
+      pushfreestack(p, nt->ustack);
+    freethread(nt);
+    release(&p->lock);
     return -1;
 }
 
 void thread_exit(void *retval){
   struct proc *curproc = myproc();
-  struct thread *t = &(curproc->t[curproc->tidx]);
+  struct thread *t = mythread();
   int cnt;
 
-  ret[curproc->tidx] = (uint)retval;
+  acquire(&curproc->lock);
 
-  acquire(&ptable.lock);
+  t->retval = retval;
 
-  if (curproc->waiting[curproc->tidx] != 0){
-    wakeup1(curproc);
-  }
+  // Wake joiners, or a thread waiting in stopthreads.
+  wakeupthreads(curproc, t, -1);
+  wakeupthreads(curproc, curproc, -1);
 
   t->state = ZOMBIE;
-  curproc->state = RUNNABLE;
 
   // if no thread has left on the process, call exit().
   cnt = 0;
-  for(t = curproc->t; t < &(curproc->t[NTHRD]); t++){
-    if (t->state != UNUSED && t->state != ZOMBIE) cnt++;
+  for(t = curproc->threads; t; t = t->tnext){
+    if (t->state != ZOMBIE) cnt++;
   }
   if (cnt == 0) {
-    release(&ptable.lock);
+    release(&curproc->lock);
     exit();
   }
 
@@ -729,55 +1866,197 @@ void thread_exit(void *retval){
 int thread_join(thread_t thread, void **retval){
   struct proc *curproc = myproc();
   struct thread *t;
-  int havekids;
-  int tidx;
-  
-  // cprintf("\n---JOIN %d %d---\n", curproc->pid, thread);
+  void *val;
 
-  if (thread == curproc->t[curproc->tidx].tid){
+  if (thread == mythread()->tid){
     cprintf("You cannot join current thread.\n");
     return -1;
   }
 
-  acquire(&ptable.lock);
+  acquire(&curproc->lock);
   for(;;){
-    havekids = 0;
-
     // Find the target thread
-    for(t = curproc->t; t < &(curproc->t[NTHRD]); t++){
-      if(t->tid != thread) continue;
-
-      tidx = t - curproc->t;
-      havekids = 1;
-      if(t->state == ZOMBIE){
-        // Found one.
-        // cprintf("%d %d exit\n", curproc->pid, t->tid);
-        kfree(t->kstack);
-        t->kstack = 0;
-        t->state = UNUSED;
-        t->tid = 0;
-        curproc->emptystack[t - curproc->t] = curproc->ustack[t - curproc->t];
-        curproc->ustack[t - curproc->t] = 0;
-        release(&ptable.lock);
-        *retval = (void *)ret[t - curproc->t];
-        return 0;
-      }
+    t = findthread(curproc, thread);
+
+    if(t != 0 && t->state == ZOMBIE){
+      // Found one.
+      val = t->retval;
+      if (t->ustack != 0)
+        pushfreestack(curproc, t->ustack);
+      freethread(t);
+      release(&curproc->lock);
+      *retval = val;
+      return 0;
     }
 
-    if(!havekids || curproc->killed || thread == 0){
+    if(t == 0 || curproc->killed || mythread()->killed || thread == 0){
       cprintf("tid doesn't exist.\n");
-      release(&ptable.lock);
+      release(&curproc->lock);
       return -1;
     }
 
     // Wait for target thread to exit. (See thread_exit call.)
-    curproc->waiting[tidx] = 1;
-    sleep(curproc, &ptable.lock);  //DOC: wait-sleep
-    curproc->waiting[tidx] = 0;
+    sleep(t, &curproc->lock);  //DOC: wait-sleep
+  }
+}
+
+
+// The segment of p's ELF file that va falls in, or 0.
+static struct segment*
+findseg(struct proc *p, uint va)
+{
+  struct segment *s;
+
+  for(s = p->seg; s < &p->seg[NSEG]; s++)
+    if(s->ip && va >= s->va && va < PGROUNDUP(s->end))
+      return s;
+  return 0;
+}
+
+// Handle a fault on the page holding va in the current process,
+// for a write if write is set. Memory below p->sz is populated
+// lazily, one page at a time: pages of the ELF file are mapped
+// read-only from the page cache (see exec and pcache.c), other
+// reads map the zero page, and the first write to a page gives
+// it memory of its own. Only single-threaded processes share
+// writable pages this way (see fork). Guard pages below user
+// stacks stay inaccessible. Returns 0 if the access can be retried.
+int
+pagefault(uint va, int write)
+{
+  struct proc *p = myproc();
+  struct segment *s;
+  struct inode *ip;
+  uint off, n;
+  char *mem, *copy;
+  int r, perm;
+
+  va = PGROUNDDOWN(va);
+  acquire(&p->lock);
+  r = -1;
+  if(va >= p->sz)
+    goto out;
+  if(uva2ka(p->pgdir, (char*)va) == 0 && (s = findseg(p, va)) != 0){
+    if(write && !s->writable)
+      goto out;
+    if(overlimit(p, va)){
+      cprintf("memory limit exceeded\n");
+      goto out;
+    }
+    // Reading the file sleeps; the segment's inode stays
+    // referenced, since only exec and exit drop it and both
+    // wait for this thread first.
+    ip = s->ip;
+    off = s->off + (va - s->va);
+    n = s->end - va < PGSIZE ? s->end - va : PGSIZE;
+    release(&p->lock);
+    mem = pcget(ip, off, n);
+    acquire(&p->lock);
+    // Another thread may have shrunk the process meanwhile.
+    if(mem == 0)
+      goto out;
+    if(va >= p->sz || findseg(p, va) != s){
+      kfree(mem);
+      goto out;
+    }
+    perm = PTE_U;
+    if(s->writable && (write || !p->cow)){
+      if((copy = kalloc()) == 0){
+        kfree(mem);
+        goto out;
+      }
+      memmove(copy, mem, PGSIZE);
+      kfree(mem);
+      mem = copy;
+      perm |= PTE_W;
+    } else if(s->writable)
+      perm |= PTE_COW;
+    r = installpage(p->pgdir, va, mem, perm);
+    goto out;
   }
+  if(!p->cow)
+    write = 1;
+  if(write && overlimit(p, va))
+    cprintf("memory limit exceeded\n");
+  else
+    r = demandpage(p->pgdir, va, write);
+ out:
+  release(&p->lock);
+  return r;
+}
+
+// Make base the start of the current thread's TLS block, so that
+// %gs:0 is the word at base. trapret reloads %gs from the GDT,
+// and the scheduler points SEG_UTLS at whichever thread it runs.
+int
+thread_settls(uint base)
+{
+  struct thread *t = mythread();
+
+  t->tls = base;
+  t->tf->gs = (SEG_UTLS << 3) | DPL_USER;
+  pushcli();
+  mycpu()->gdt[SEG_UTLS] = SEG(STA_W, base, 0xffffffff, DPL_USER);
+  popcli();
+  return 0;
 }
 
 
+// futex implementation
+
+// Kernel address of the user word at addr in p, or 0 if addr is
+// not a valid, aligned word. The kernel address identifies the
+// (pgdir, addr) pair and serves as the sleep channel.
+static uint*
+futexkey(struct proc *p, uint addr)
+{
+  char *page;
+
+  if(addr % 4 != 0 || addr >= p->sz || addr + 4 > p->sz)
+    return 0;
+  if((page = uva2ka(p->pgdir, (char*)PGROUNDDOWN(addr))) == 0)
+    return 0;
+  return (uint*)(page + (addr & (PGSIZE-1)));
+}
+
+// Sleep until futex_wake() on addr, unless the word at addr no
+// longer holds val. Checking the word and going to sleep happen
+// under p->lock, so a wake after the word changed is not lost.
+int futex_wait(uint addr, uint val){
+  struct proc *p = myproc();
+  uint *key;
+
+  acquire(&p->lock);
+  if((key = futexkey(p, addr)) == 0 || *key != val ||
+     p->killed || mythread()->killed){
+    release(&p->lock);
+    return -1;
+  }
+  sleep(key, &p->lock);
+  release(&p->lock);
+  return 0;
+}
+
+// Wake up to n threads waiting in futex_wait() on addr.
+// Returns the number of threads woken.
+int futex_wake(uint addr, int n){
+  struct proc *p = myproc();
+  uint *key;
+  int woken;
+
+  if(n <= 0)
+    return 0;
+  acquire(&p->lock);
+  if((key = futexkey(p, addr)) == 0){
+    release(&p->lock);
+    return -1;
+  }
+  // Only threads sharing p's page table can wait on this word.
+  woken = wakeupthreads(p, key, n);
+  release(&p->lock);
+  return woken;
+}
+
 
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
@@ -796,9 +2075,12 @@ procdump(void)
   };
   int i;
   struct proc *p;
+  struct thread *t;
   char *state;
   uint pc[10];
 
+  for(i = 0; i < ncpu; i++)
+    cprintf("cpu%d: %d timer interrupts\n", i, cpus[i].ntimer);
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if(p->state == UNUSED)
       continue;
@@ -806,40 +2088,48 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    cprintf("%d %s %s", p->pid, state, p->name);
-    if(p->state == SLEEPING){
-      getcallerpcs((uint*)p->t[p->tidx].context->ebp+2, pc);
-      for(i=0; i<10 && pc[i] != 0; i++)
-        cprintf(" %p", pc[i]);
+    cprintf("%d %s %s\n", p->pid, state, p->name);
+    for(t = p->threads; t; t = t->tnext){
+      if(t->state >= 0 && t->state < NELEM(states) && states[t->state])
+        state = states[t->state];
+      else
+        state = "???";
+      cprintf("  tid %d %s", t->tid, state);
+      if(t->state == SLEEPING){
+        getcallerpcs((uint*)t->context->ebp+2, pc);
+        for(i=0; i<10 && pc[i] != 0; i++)
+          cprintf(" %p", pc[i]);
+      }
+      cprintf("\n");
     }
-    cprintf("\n");
   }
 }
 
 void proclist(void){
   struct proc* p;
   // struct thread* t;
-  cprintf("Process Name\t pid\tnumofstackpage\tmemsize\t memmax\n");
-  cprintf("=========================================================\n");
+  cprintf("Process Name\t pid\tnumofstackpage\tmemsize\t memmax\t cpumask tickets\n");
+  cprintf("=============================================================================\n");
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
       if (p->state == UNUSED || p->state == ZOMBIE || p->state == EMBRYO) continue;
       if (strlen(p->name) < 8) cprintf("%s\t\t ", p->name);
       else if (strlen(p->name) < 16) cprintf("%s\t ", p->name);
       else cprintf("%s ", p->name);
-      cprintf("%d\t%d\t\t%d\t %d\t\n", p->pid, p->stacksize, p->sz, p->memlimit);
+      cprintf("%d\t%d\t\t%d\t %d\t %x\t %d\n", p->pid, p->stacksize, p->sz, p->memlimit,
+              p->affinity & ((1 << ncpu) - 1), p->tickets);
       
       // check process and thread state (debugging)
       // cprintf("%d : ", p->state);
-      // for (t = p->t; t < &p->t[NTHRD]; t++){
+      // for (t = p->threads; t; t = t->tnext){
       //   cprintf("%d ",t->state);
       // }
       // cprintf("\n");
-      // for (t = p->t; t < &p->t[NTHRD]; t++){
-      //   cprintf("%d ",p->ustack[t - p->t]);
+      // for (t = p->threads; t; t = t->tnext){
+      //   cprintf("%d ",t->ustack);
       // }
       // cprintf("\n");
-      // for (t = p->t; t < &p->t[NTHRD]; t++){
-      //   cprintf("%d ",p->emptystack[t - p->t]);
+      // for (i = 0; i < p->nfreestack; i++){
+      //   cprintf("%d ",p->freestack[i]);
       // }
       // cprintf("\n");
   }
@@ -847,3 +2137,78 @@ void proclist(void){
 }
 
 
+
+// Copy len bytes from src to user address va in the current
+// process, mapping pages and breaking copy-on-write sharing as a
+// user write would (see pagefault). Caller must hold no p->lock.
+static int
+copytouser(uint va, void *src, uint len)
+{
+  uint a;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE)
+    if(pagefault(a, 1) < 0)
+      return -1;
+  return copyout(myproc()->pgdir, va, src, len);
+}
+
+// Copy the scheduling statistics of up to n live threads to the
+// user buffer at addr. Returns the number of threads copied.
+// The statistics are gathered NTSTAT at a time under p->lock and
+// copied out without it, since copying may fault pages in.
+#define NTSTAT 16
+int threadstat(uint addr, int n){
+  struct proc *p;
+  struct thread *t;
+  struct tstat ts[NTSTAT];
+  int i, k, done, skip, more;
+
+  i = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC] && i < n; p++){
+    done = 0;
+    do {
+      acquire(&p->lock);
+      if (p->state == UNUSED || p->state == ZOMBIE || p->state == EMBRYO){
+        release(&p->lock);
+        break;
+      }
+      // Pick up after the threads of p copied in the last round.
+      skip = done;
+      k = 0;
+      more = 0;
+      for(t = p->threads; t; t = t->tnext){
+        if (t->state == UNUSED || t->state == ZOMBIE) continue;
+        if (skip > 0){
+          skip--;
+          continue;
+        }
+        if (k == NTSTAT || i + k == n){
+          more = i + k < n;
+          break;
+        }
+        ts[k].pid = p->pid;
+        ts[k].tid = t->tid;
+        ts[k].state = t->state;
+        ts[k].cpu = t->lastcpu;
+        ts[k].affinity = t->affinity & p->affinity & ((1 << ncpu) - 1);
+        ts[k].runticks = t->runticks;
+        ts[k].waitticks = t->waitticks;
+        ts[k].nvswitch = t->nvswitch;
+        ts[k].nivswitch = t->nivswitch;
+        ts[k].nmiss = p->nmiss;
+        // The running thread is still being charged.
+        if (t->state == RUNNING)
+          ts[k].runticks += (t->runfrac + clocknow() - t->runclock) / TICKFRAC;
+        if (t->state == RUNNABLE)
+          ts[k].waitticks += ticks - t->readysince;
+        k++;
+      }
+      release(&p->lock);
+      if (k > 0 && copytouser(addr + i*sizeof(ts[0]), ts, k*sizeof(ts[0])) < 0)
+        return i;
+      i += k;
+      done += k;
+    } while(more);
+  }
+  return i;
+}
@@ -8,6 +8,11 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  volatile uint idle;          // Halted in scheduler() waiting for work?
+  volatile uint sliced;        // Timer armed to end the time slice? (TICKLESS)
+  volatile uint preempt;       // EDF job queued here to preempt the running thread?
+  uint ntimer;                 // Timer interrupts taken
+  struct thread *thread;       // The thread of proc running on this cpu
 };
 
 extern struct cpu cpus[NCPU];
@@ -34,34 +39,92 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// Thread descriptors are allocated on demand and live at the
+// bottom of the thread's kernel stack page (see allocthread).
 struct thread {
-  char *kstack;                // Bottom of kernel stack for this process
+  char *kstack;                // Bottom of kernel stack for this thread
   enum procstate state;        // Process state
   thread_t tid;                // Thread ID
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  int killed;                  // If non-zero, told to exit by exit()/exec()
+  void *retval;                // Value passed to thread_exit
+  struct proc *proc;           // Process this thread belongs to
+  int cpu;                     // CPU whose run queue the thread goes on
+  struct thread *next;         // Next thread on that run queue
+  struct thread *tnext;        // Next thread of the same process
+  struct thread *tprev;        // Previous thread of the same process
+  struct thread *hnext;        // Next thread in the tid hash chain
+  struct thread *wnext;        // Next thread on chan's wait queue
+  struct thread *wprev;        // Previous thread on chan's wait queue
+  uint wseq;                   // When it joined the wait queue
+  uint ustack;                 // Top of the thread's user stack
+  uint tls;                    // Base of SEG_UTLS while this thread runs
+  uint affinity;               // Mask of CPUs the thread may run on
+  int lastcpu;                 // CPU the thread last ran on
+  uint runstart;               // ticks when it last started running
+  uint runclock;               // clocknow() when it last started running
+  uint readysince;             // ticks when it last became RUNNABLE
+  uint runticks;               // Ticks spent running
+  uint runfrac;                // and TICKFRAC-ths of a tick more
+  uint waitticks;              // Ticks spent RUNNABLE but not running
+  uint nvswitch;               // Voluntary switches (sleep)
+  uint nivswitch;              // Involuntary switches (yield)
+  int tickets;                 // Share among the threads of proc
+  uint pass;                   // Stride-scheduling pass among them
 };
 
-// Per-process state
+// Part of a process's memory that is read from its ELF file on
+// first touch (see pagefault). Bytes from end up to the next
+// segment are zero.
+struct segment {
+  struct inode *ip;            // File to read from, or 0 if unused
+  uint va;                     // First address, page-aligned
+  uint end;                    // End of the file's bytes: va + filesz
+  uint off;                    // Offset of va in the file
+  int writable;                // May the pages be written?
+};
+
+// Per-process state.
+// p->lock protects the process and all of its threads, except
+// p->parent, which ptable.waitlock protects. A thread holds its
+// process's lock across swtch() to and from the scheduler.
 struct proc {
+  struct spinlock lock;
   uint sz;                     // Size of process memory (bytes)
   pde_t* pgdir;                // Page table
   enum procstate state;        // Process state
   int pid;                     // Process ID
   struct proc *parent;         // Parent process
   int killed;                  // If non-zero, have been killed
+  int frozen;                  // If non-zero, threads may not be scheduled
+  int nsleeping;               // Number of SLEEPING threads
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
   int stacksize;               // User stack size(page)
   int memlimit;                // Memory limit of the process
+  uint affinity;               // Mask of CPUs its threads may run on
+  int tickets;                 // Stride-scheduling tickets, 1..MAXTICKETS
+  uint pass;                   // CPU ticks charged, scaled by 1/tickets
+  uint tpass;                  // pass of the thread of p last picked
+  int period;                  // EDF period in ticks, or 0 if not real-time
+  int runtime;                 // EDF ticks of CPU per period
+  int deadline;                // EDF deadline, in ticks after each release
+  uint rtutil;                 // runtime/period, in RTUNITs
+  int rtcpu;                   // CPU the EDF reservation is on
+  uint jobstart;               // ticks when the current job was released
+  uint budget;                 // Ticks of runtime the current job has left
+  int jobdone;                 // Has the current job finished?
+  uint nmiss;                  // Jobs that missed their deadline
+  int cow;                     // Single-threaded; may share pages (see fork)
+  struct segment seg[NSEG];    // Memory read from the ELF file on demand
 
-  struct thread t[NTHRD];      // Thread array
-  uint ustack[NTHRD];          // user stack space already using by 
-  uint emptystack[NTHRD];      // user stack space cleaned by thread_exit
-  int tidx;                    // Running thread index
-  int waiting[NTHRD];          // Need for thread join
+  struct thread *threads;      // List of the process's threads
+  struct thread *tidhash[NTIDHASH];  // The same threads, hashed by tid
+  uint *freestack;             // Page of user stack tops freed by thread_join
+  int nfreestack;              // Number of entries in freestack
 };
 
 // Process memory is laid out contiguously, low addresses first:
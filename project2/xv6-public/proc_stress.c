@@ -0,0 +1,87 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NUM_WORKER 4
+#define NUM_FORK 50
+#define NUM_THREAD_ROUND 200
+
+void *thread_main(void *arg)
+{
+  thread_exit(arg);
+  return 0;
+}
+
+// Each worker forks and reaps children in a loop.
+void fork_worker(void)
+{
+  int i, pid;
+
+  for (i = 0; i < NUM_FORK; i++) {
+    pid = fork();
+    if (pid < 0) {
+      printf(1, "panic at fork\n");
+      exit();
+    }
+    if (pid == 0)
+      exit();
+    if (wait() != pid) {
+      printf(1, "panic at wait\n");
+      exit();
+    }
+  }
+  exit();
+}
+
+// Each worker creates and joins threads in a loop.
+void thread_worker(void)
+{
+  thread_t t;
+  void *retval;
+  int i;
+
+  for (i = 0; i < NUM_THREAD_ROUND; i++) {
+    t = i + 2;
+    if (thread_create(&t, thread_main, (void *)i) != 0) {
+      printf(1, "panic at thread_create\n");
+      exit();
+    }
+    if (thread_join(t, &retval) != 0 || (int)retval != i) {
+      printf(1, "panic at thread_join\n");
+      exit();
+    }
+  }
+  exit();
+}
+
+// Run nworker copies of worker at once and return the ticks taken.
+int run(void (*worker)(void), int nworker)
+{
+  int i, start;
+
+  start = uptime();
+  for (i = 0; i < nworker; i++) {
+    if (fork() == 0)
+      worker();
+  }
+  for (i = 0; i < nworker; i++)
+    wait();
+  return uptime() - start;
+}
+
+int main(int argc, char *argv[])
+{
+  int n, nworker;
+
+  nworker = NUM_WORKER;
+  if (argc > 1)
+    nworker = atoi(argv[1]);
+
+  printf(1, "Process stress test start: %d workers\n", nworker);
+  for (n = 1; n <= nworker; n *= 2) {
+    printf(1, "%d workers: fork/exit %d ticks, ", n, run(fork_worker, n));
+    printf(1, "thread create/join %d ticks\n", run(thread_worker, n));
+  }
+  printf(1, "Process stress test finished\n");
+  exit();
+}
@@ -52,12 +52,16 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
+int gettoken(char**, char*, char**, char**);
+int spawnable(struct cmd*);
+int spawncmd(struct cmd*, int*);
 
 // Execute cmd.  Never returns.
 void
 runcmd(struct cmd *cmd)
 {
-  int p[2];
+  int p[2], fd[3];
   struct backcmd *bcmd;
   struct execcmd *ecmd;
   struct listcmd *lcmd;
@@ -101,14 +105,24 @@ runcmd(struct cmd *cmd)
     pcmd = (struct pipecmd*)cmd;
     if(pipe(p) < 0)
       panic("pipe");
-    if(fork1() == 0){
+    if(spawnable(pcmd->left)){
+      fd[0] = 0;
+      fd[1] = p[1];
+      fd[2] = 2;
+      spawncmd(pcmd->left, fd);
+    } else if(fork1() == 0){
       close(1);
       dup(p[1]);
       close(p[0]);
       close(p[1]);
       runcmd(pcmd->left);
     }
-    if(fork1() == 0){
+    if(spawnable(pcmd->right)){
+      fd[0] = p[0];
+      fd[1] = 1;
+      fd[2] = 2;
+      spawncmd(pcmd->right, fd);
+    } else if(fork1() == 0){
       close(0);
       dup(p[0]);
       close(p[0]);
@@ -130,6 +144,73 @@ runcmd(struct cmd *cmd)
   exit();
 }
 
+// Can spawncmd() start cmd: is it a program, with at most
+// some redirections?
+int
+spawnable(struct cmd *cmd)
+{
+  while(cmd->type == REDIR)
+    cmd = ((struct redircmd*)cmd)->cmd;
+  return cmd->type == EXEC && ((struct execcmd*)cmd)->argv[0] != 0;
+}
+
+// Start the spawnable cmd without forking the shell, with fd[i]
+// as its file descriptor i before redirections.
+// Returns its pid, or -1 if it could not be started.
+int
+spawncmd(struct cmd *cmd, int *fd)
+{
+  int i, pid, map[3], opened[3];
+  struct execcmd *ecmd;
+  struct redircmd *rcmd;
+
+  for(i = 0; i < 3; i++){
+    map[i] = fd[i];
+    opened[i] = -1;
+  }
+  pid = -1;
+  // The innermost redirection of a file descriptor wins, as in
+  // runcmd().
+  for(; cmd->type == REDIR; cmd = rcmd->cmd){
+    rcmd = (struct redircmd*)cmd;
+    if(opened[rcmd->fd] >= 0)
+      close(opened[rcmd->fd]);
+    if((opened[rcmd->fd] = open(rcmd->file, rcmd->mode)) < 0){
+      printf(2, "open %s failed\n", rcmd->file);
+      goto out;
+    }
+    map[rcmd->fd] = opened[rcmd->fd];
+  }
+  ecmd = (struct execcmd*)cmd;
+  if((pid = spawn(ecmd->argv[0], ecmd->argv, 1, map, 3)) < 0)
+    printf(2, "exec %s failed\n", ecmd->argv[0]);
+out:
+  for(i = 0; i < 3; i++)
+    if(opened[i] >= 0)
+      close(opened[i]);
+  return pid;
+}
+
+// Is the line s just a program with arguments and redirections,
+// which parsecmd() accepts without failing?
+int
+simple(char *s)
+{
+  char *es;
+  int tok, nword;
+
+  es = s + strlen(s);
+  nword = 0;
+  while((tok = gettoken(&s, es, 0, 0)) != 0){
+    if(tok == '<' || tok == '>' || tok == '+'){
+      if(gettoken(&s, es, 0, 0) != 'a')
+        return 0;
+    } else if(tok != 'a' || ++nword >= MAXARGS)
+      return 0;
+  }
+  return nword > 0;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -145,7 +226,8 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  int fd, std[3];
+  struct cmd *cmd;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -164,6 +246,18 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
+    // Start plain commands directly rather than from a copy of
+    // the shell; the rest are run by a forked shell.
+    if(simple(buf)){
+      cmd = parsecmd(buf);
+      std[0] = 0;
+      std[1] = 1;
+      std[2] = 2;
+      if(spawncmd(cmd, std) >= 0)
+        wait();
+      freecmd(cmd);
+      continue;
+    }
     if(fork1() == 0)
       runcmd(parsecmd(buf));
     wait();
@@ -491,3 +585,32 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free the parsed command cmd.
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+
+  case LIST:
+    freecmd(((struct listcmd*)cmd)->left);
+    freecmd(((struct listcmd*)cmd)->right);
+    break;
+
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
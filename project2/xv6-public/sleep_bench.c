@@ -0,0 +1,81 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "tstat.h"
+
+#define NUM_SLEEPER 16
+#define WINDOW 100
+#define NUM_NAP 20
+#define NSTAT 256
+
+struct tstat stats[NSTAT];
+int pids[NUM_SLEEPER];
+
+// Total number of times the sleepers have gone to sleep.
+int sleeps(void)
+{
+  int i, j, n, total;
+
+  n = threadstat(stats, NSTAT);
+  total = 0;
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < NUM_SLEEPER; j++) {
+      if (stats[i].pid == pids[j])
+        total += stats[i].nvswitch;
+    }
+  }
+  return total;
+}
+
+// Time NUM_NAP nanosleeps of nsec nanoseconds each.
+void nap(int nsec)
+{
+  int i, start;
+
+  start = uptime();
+  for (i = 0; i < NUM_NAP; i++) {
+    if (nanosleep(0, nsec) != 0) {
+      printf(1, "panic at nanosleep\n");
+      exit();
+    }
+  }
+  printf(1, "%d x nanosleep(0, %d): %d ticks\n", NUM_NAP, nsec, uptime() - start);
+}
+
+int main(int argc, char *argv[])
+{
+  int i, before, after;
+
+  printf(1, "Sleep benchmark start\n");
+
+  // Sleepers that stay asleep for the whole window. Each wakeup
+  // of a sleeper shows up as one more voluntary switch.
+  for (i = 0; i < NUM_SLEEPER; i++) {
+    pids[i] = fork();
+    if (pids[i] < 0) {
+      printf(1, "panic at fork\n");
+      exit();
+    }
+    if (pids[i] == 0) {
+      sleep(10 * WINDOW);
+      exit();
+    }
+  }
+  sleep(5);
+  before = sleeps();
+  sleep(WINDOW);
+  after = sleeps();
+  printf(1, "%d sleepers: %d wakeups in %d ticks\n",
+         NUM_SLEEPER, after - before, WINDOW);
+  for (i = 0; i < NUM_SLEEPER; i++)
+    kill(pids[i]);
+  for (i = 0; i < NUM_SLEEPER; i++)
+    wait();
+
+  nap(1000000);
+  nap(10000000);
+  nap(25000000);
+
+  printf(1, "Sleep benchmark finished\n");
+  exit();
+}
@@ -0,0 +1,204 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "tstat.h"
+#include "x86.h"
+
+#define NUM_SPINNER 3
+#define DURATION 300
+#define NSTAT 256
+#define NAPNS 100000  // a nap, in nanoseconds
+
+int tickets[NUM_SPINNER] = {10, 20, 30};
+int pids[NUM_SPINNER];
+int tids[NUM_SPINNER];
+int counts[NUM_SPINNER];
+struct tstat stats[NSTAT];
+volatile int done;
+uint cyclespertick;
+int gate[2];
+
+void *thread_main(void *arg)
+{
+  while (!done)
+    ;
+  thread_exit(0);
+  return 0;
+}
+
+// Add the ticks each spinner has run so far, times sign, to counts.
+void sample(int sign)
+{
+  int i, j, n;
+
+  n = threadstat(stats, NSTAT);
+  for (i = 0; i < n; i++)
+    for (j = 0; j < NUM_SPINNER; j++)
+      if (stats[i].pid == pids[j] && stats[i].tid == tids[j])
+        counts[j] += sign * stats[i].runticks;
+}
+
+// Count the ticks the spinners run for DURATION ticks, then
+// print each one's share of them next to its share of the
+// tickets, both in tenths of a percent.
+void measure(char *what)
+{
+  int i, total, alltickets, share, expect;
+
+  for (i = 0; i < NUM_SPINNER; i++)
+    counts[i] = 0;
+  sleep(10);
+  sample(-1);
+  sleep(DURATION);
+  sample(1);
+
+  total = alltickets = 0;
+  for (i = 0; i < NUM_SPINNER; i++) {
+    total += counts[i];
+    alltickets += tickets[i];
+  }
+  printf(1, "%s:\n", what);
+  for (i = 0; i < NUM_SPINNER; i++) {
+    share = total ? counts[i] * 1000 / total : 0;
+    expect = tickets[i] * 1000 / alltickets;
+    printf(1, "  tickets %d: %d ticks, %d.%d%% (expected %d.%d%%)\n",
+           tickets[i], counts[i], share / 10, share % 10, expect / 10, expect % 10);
+  }
+}
+
+// Competing processes, all on CPU 0. They wait on a pipe until
+// all of them are pinned, so none runs ahead on another CPU.
+void procs(void)
+{
+  int i, fd[2];
+  char c;
+
+  if (pipe(fd) < 0) {
+    printf(1, "panic at pipe\n");
+    exit();
+  }
+  for (i = 0; i < NUM_SPINNER; i++) {
+    if ((pids[i] = fork()) == 0) {
+      read(fd[0], &c, 1);
+      for (;;)
+        ;
+    }
+    tids[i] = 1;
+    set_affinity(pids[i], -1, 1);
+    set_tickets(pids[i], -1, tickets[i]);
+  }
+  for (i = 0; i < NUM_SPINNER; i++)
+    write(fd[1], "g", 1);
+  close(fd[0]);
+  close(fd[1]);
+  measure("processes");
+  for (i = 0; i < NUM_SPINNER; i++)
+    kill(pids[i]);
+  for (i = 0; i < NUM_SPINNER; i++)
+    wait();
+}
+
+// Competing threads of one process, all on CPU 0.
+void threads(void)
+{
+  thread_t thread[NUM_SPINNER];
+  void *retval;
+  int i;
+
+  done = 0;
+  for (i = 0; i < NUM_SPINNER; i++) {
+    thread[i] = i + 2;
+    if (thread_create(&thread[i], thread_main, 0) != 0) {
+      printf(1, "panic at thread_create\n");
+      exit();
+    }
+    pids[i] = getpid();
+    tids[i] = thread[i];
+    set_affinity(getpid(), thread[i], 1);
+    set_tickets(getpid(), thread[i], tickets[i]);
+  }
+  measure("threads");
+  done = 1;
+  for (i = 0; i < NUM_SPINNER; i++)
+    thread_join(thread[i], &retval);
+}
+
+// TSC cycles per clock tick, timed over a few ticks.
+uint calibrate(void)
+{
+  uint t0, c0;
+
+  t0 = uptime();
+  while (uptime() == t0)
+    ;
+  c0 = rdtsc();
+  while (uptime() < t0 + 11)
+    ;
+  return (rdtsc() - c0) / 10;
+}
+
+// Spin for most of a tick at a time; thread 0 naps in between,
+// giving up the CPU just before a tick's worth of running ends.
+void *worker(void *arg)
+{
+  uint c0;
+  char c;
+
+  read(gate[0], &c, 1);
+  while (!done) {
+    c0 = rdtsc();
+    while (rdtsc() - c0 < cyclespertick / 10 * 9)
+      ;
+    if (arg == 0)
+      nanosleep(0, NAPNS);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+// Like threads, but the thread with the fewest tickets sleeps
+// before each tick ends: blocking must not get it more than its
+// tickets' share, nor less. As in procs, the threads wait on a
+// pipe until all of them are pinned.
+void napper(void)
+{
+  thread_t thread[NUM_SPINNER];
+  void *retval;
+  int i;
+
+  cyclespertick = calibrate();
+  if (pipe(gate) < 0) {
+    printf(1, "panic at pipe\n");
+    exit();
+  }
+  done = 0;
+  for (i = 0; i < NUM_SPINNER; i++) {
+    thread[i] = i + 2;
+    if (thread_create(&thread[i], worker, (void *)i) != 0) {
+      printf(1, "panic at thread_create\n");
+      exit();
+    }
+    pids[i] = getpid();
+    tids[i] = thread[i];
+    set_affinity(getpid(), thread[i], 1);
+    set_tickets(getpid(), thread[i], tickets[i]);
+  }
+  for (i = 0; i < NUM_SPINNER; i++)
+    write(gate[1], "g", 1);
+  measure("threads, tickets 10 napping");
+  done = 1;
+  for (i = 0; i < NUM_SPINNER; i++)
+    thread_join(thread[i], &retval);
+  close(gate[0]);
+  close(gate[1]);
+}
+
+int main(int argc, char *argv[])
+{
+  printf(1, "Stride benchmark start\n");
+  procs();
+  threads();
+  napper();
+  printf(1, "Stride benchmark finished\n");
+  exit();
+}
@@ -0,0 +1,72 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+#define NUM_ROUND 2000
+
+// Print the result line for ops operations done in ticks.
+void report(char *name, int npair, uint ops, uint ticks)
+{
+  uint us;
+
+  if (ticks == 0)
+    ticks = 1;
+  us = ticks * (TICKNS / 1000);
+  printf(1, "%s pairs=%d ops=%d ticks=%d ops_per_sec=%d ns_per_op=%d\n",
+         name, npair, ops, ticks, ops * (1000000000 / TICKNS) / ticks,
+         us / ops * 1000 + us % ops * 1000 / ops);
+}
+
+// Bounce a byte NUM_ROUND times between this process and a child
+// of its own over two pipes, once go can be read.
+void pair(int go)
+{
+  int ping[2], pong[2], i;
+  char c;
+
+  if (pipe(ping) < 0 || pipe(pong) < 0) {
+    printf(1, "panic at pipe\n");
+    exit();
+  }
+  if (fork() == 0) {
+    for (i = 0; i < NUM_ROUND; i++) {
+      read(ping[0], &c, 1);
+      write(pong[1], &c, 1);
+    }
+    exit();
+  }
+  read(go, &c, 1);
+  for (i = 0; i < NUM_ROUND; i++) {
+    write(ping[1], &c, 1);
+    read(pong[0], &c, 1);
+  }
+  wait();
+  exit();
+}
+
+// Context-switch latency: npair pairs of processes play pipe
+// ping-pong at once. Each round trip is two switches.
+int main(int argc, char *argv[])
+{
+  int npair, i, go[2], start;
+
+  npair = argc > 1 ? atoi(argv[1]) : 1;
+  if (npair < 1 || pipe(go) < 0) {
+    printf(1, "usage: switch_bench [npair]\n");
+    exit();
+  }
+  for (i = 0; i < npair; i++) {
+    if (fork() == 0)
+      pair(go[0]);
+  }
+  // Let the pairs fork their partners before starting the clock.
+  sleep(npair * 5);
+  start = uptime();
+  for (i = 0; i < npair; i++)
+    write(go[1], "g", 1);
+  for (i = 0; i < npair; i++)
+    wait();
+  report("switch_bench", npair, 2 * npair * NUM_ROUND, uptime() - start);
+  exit();
+}
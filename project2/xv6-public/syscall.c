@@ -3,6 +3,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
@@ -13,6 +14,28 @@
 // library system call function. The saved user %esp points
 // to a saved program counter, and then the first argument.
 
+// Make sure the pages holding [addr, addr+n) in the current
+// process are mapped, so that the kernel can use them directly.
+// User memory is only populated on first touch (see pagefault).
+// If write is set the pages must be writable by the process and
+// get memory of their own now: a kernel write to a read-only
+// page of the program would fault with no way to fail the call.
+static int
+prefault(uint addr, uint n, int write)
+{
+  struct proc *curproc = myproc();
+  uint a;
+
+  for(a = PGROUNDDOWN(addr); a < addr + n; a += PGSIZE){
+    if(write){
+      if(pagefault(a, 1) < 0)
+        return -1;
+    } else if(uva2ka(curproc->pgdir, (char*)a) == 0 && pagefault(a, 0) < 0)
+      return -1;
+  }
+  return 0;
+}
+
 // Fetch the int at addr from the current process.
 int
 fetchint(uint addr, int *ip)
@@ -21,6 +44,8 @@ fetchint(uint addr, int *ip)
 
   if(addr >= curproc->sz || addr+4 > curproc->sz)
     return -1;
+  if(prefault(addr, 4, 0) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -39,6 +64,8 @@ fetchstr(uint addr, char **pp)
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && prefault((uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -49,15 +76,11 @@ fetchstr(uint addr, char **pp)
 int
 argint(int n, int *ip)
 {
-  struct proc* curproc = myproc();
-  return fetchint((curproc->t[curproc->tidx].tf->esp) + 4 + 4*n, ip);
+  return fetchint((mythread()->tf->esp) + 4 + 4*n, ip);
 }
 
-// Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+static int
+fetchptr(int n, char **pp, int size, int write)
 {
   int i;
   struct proc *curproc = myproc();
@@ -66,10 +89,29 @@ argptr(int n, char **pp, int size)
     return -1;
   if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
     return -1;
+  if(prefault(i, size, write) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes.  Check that the pointer
+// lies within the process address space.
+int
+argptr(int n, char **pp, int size)
+{
+  return fetchptr(n, pp, size, 0);
+}
+
+// Like argptr, for a block the system call writes to.
+// Fails if the process may not write all of it.
+int
+argwptr(int n, char **pp, int size)
+{
+  return fetchptr(n, pp, size, 1);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
@@ -110,6 +152,17 @@ extern int sys_setmemorylimit(void);
 extern int sys_thread_create(void);
 extern int sys_thread_exit(void);
 extern int sys_thread_join(void);
+extern int sys_futex_wait(void);
+extern int sys_futex_wake(void);
+extern int sys_thread_settls(void);
+extern int sys_threadstat(void);
+extern int sys_set_affinity(void);
+extern int sys_get_affinity(void);
+extern int sys_set_tickets(void);
+extern int sys_nanosleep(void);
+extern int sys_set_deadline(void);
+extern int sys_yield(void);
+extern int sys_spawn(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -139,6 +192,17 @@ static int (*syscalls[])(void) = {
 [SYS_thread_create] sys_thread_create,
 [SYS_thread_exit] sys_thread_exit,
 [SYS_thread_join] sys_thread_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_thread_settls] sys_thread_settls,
+[SYS_threadstat] sys_threadstat,
+[SYS_set_affinity] sys_set_affinity,
+[SYS_get_affinity] sys_get_affinity,
+[SYS_set_tickets] sys_set_tickets,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_set_deadline] sys_set_deadline,
+[SYS_yield] sys_yield,
+[SYS_spawn] sys_spawn,
 };
 
 void
@@ -147,12 +211,12 @@ syscall(void)
   int num;
   struct proc *curproc = myproc();
 
-  num = curproc->t[curproc->tidx].tf->eax;
+  num = mythread()->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
-    curproc->t[curproc->tidx].tf->eax = syscalls[num]();
+    mythread()->tf->eax = syscalls[num]();
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             curproc->pid, curproc->name, num);
-    curproc->t[curproc->tidx].tf->eax = -1;
+    mythread()->tf->eax = -1;
   }
 }
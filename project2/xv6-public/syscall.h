@@ -26,3 +26,14 @@
 #define SYS_thread_create 25
 #define SYS_thread_exit 26
 #define SYS_thread_join 27
+#define SYS_futex_wait 28
+#define SYS_futex_wake 29
+#define SYS_thread_settls 30
+#define SYS_threadstat 31
+#define SYS_set_affinity 32
+#define SYS_get_affinity 33
+#define SYS_set_tickets 34
+#define SYS_nanosleep 35
+#define SYS_set_deadline 36
+#define SYS_yield 37
+#define SYS_spawn 38
@@ -5,6 +5,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 
 int
@@ -60,20 +61,36 @@ int
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
-  if(argint(0, &n) < 0)
+  if(argint(0, &n) < 0 || n < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
+  return tsleep(n, 0);
+}
+
+// nanosleep(sec, nsec): sleep for sec seconds plus nsec
+// nanoseconds, rounded up to the next 1/TICKFRAC of a clock tick
+// (about 10us). Without TICKLESS, to whole ticks (see tsleep).
+int
+sys_nanosleep(void)
+{
+  int sec, nsec;
+  uint frac;
+
+  if(argint(0, &sec) < 0 || argint(1, &nsec) < 0)
+    return -1;
+  if(sec < 0 || nsec < 0 || nsec >= 1000000000)
+    return -1;
+  if(sec > 0x7fffffff / (1000000000 / TICKNS) - 1)
+    return -1;
+  frac = (nsec % TICKNS + TICKNS/TICKFRAC - 1) / (TICKNS/TICKFRAC);
+  return tsleep(sec * (1000000000 / TICKNS) + nsec / TICKNS, frac);
+}
+
+// Give up the CPU to the next runnable thread, if any.
+int
+sys_yield(void)
+{
+  yield();
   return 0;
 }
 
@@ -85,6 +102,7 @@ sys_uptime(void)
   uint xticks;
 
   acquire(&tickslock);
+  clockupdate();
   xticks = ticks;
   release(&tickslock);
   return xticks;
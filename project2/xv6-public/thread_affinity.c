@@ -0,0 +1,82 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "tstat.h"
+
+#define NUM_THREAD 4
+#define NUM_ROUND 20
+#define NSTAT 64
+
+int pid, ncpu;
+
+// CPU the calling thread of pid with the given tid is running on.
+int current_cpu(int tid)
+{
+  struct tstat stats[NSTAT];
+  int i, n;
+
+  n = threadstat(stats, NSTAT);
+  for (i = 0; i < n; i++)
+    if (stats[i].pid == pid && stats[i].tid == tid)
+      return stats[i].cpu;
+  return -1;
+}
+
+void *thread_main(void *arg)
+{
+  int tid = (int)arg;
+  int cpu = tid % ncpu;
+  int i, j;
+
+  if (set_affinity(pid, tid, 1 << cpu) != 0) {
+    printf(1, "panic at set_affinity\n");
+    exit();
+  }
+  if (get_affinity(pid, tid) != 1 << cpu) {
+    printf(1, "panic at get_affinity\n");
+    exit();
+  }
+  for (i = 0; i < NUM_ROUND; i++) {
+    for (j = 0; j < 100000; j++)
+      ;
+    sleep(1);
+    if (current_cpu(tid) != cpu) {
+      printf(1, "Thread %d runs on cpu %d, pinned to %d\n", tid, current_cpu(tid), cpu);
+      exit();
+    }
+  }
+  thread_exit(0);
+  return 0;
+}
+
+thread_t thread[NUM_THREAD];
+
+int main(int argc, char *argv[])
+{
+  int i, all;
+  void *retval;
+
+  pid = getpid();
+  printf(1, "Thread affinity test start\n");
+
+  all = get_affinity(pid, -1);
+  for (ncpu = 0; all & (1 << ncpu); ncpu++)
+    ;
+  if (ncpu == 0 || set_affinity(pid, -1, 0) == 0) {
+    printf(1, "panic: bad mask accepted\n");
+    exit();
+  }
+
+  for (i = 0; i < NUM_THREAD; i++) {
+    thread[i] = i + 2;
+    if (thread_create(&thread[i], thread_main, (void *)thread[i]) != 0) {
+      printf(1, "panic at thread_create\n");
+      exit();
+    }
+  }
+  for (i = 0; i < NUM_THREAD; i++)
+    thread_join(thread[i], &retval);
+
+  printf(1, "Thread affinity test finished\n");
+  exit();
+}
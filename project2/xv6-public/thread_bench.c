@@ -0,0 +1,56 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+#define NUM_CREATE 1000
+#define MAX_THREAD 32
+
+// Print the result line for ops operations done in ticks.
+void report(char *name, int nthread, uint ops, uint ticks)
+{
+  uint us;
+
+  if (ticks == 0)
+    ticks = 1;
+  us = ticks * (TICKNS / 1000);
+  printf(1, "%s nthread=%d ops=%d ticks=%d ops_per_sec=%d ns_per_op=%d\n",
+         name, nthread, ops, ticks, ops * (1000000000 / TICKNS) / ticks,
+         us / ops * 1000 + us % ops * 1000 / ops);
+}
+
+void *thread_main(void *arg)
+{
+  thread_exit(arg);
+  return 0;
+}
+
+// thread_create+thread_join rate: create nthread threads, join
+// them all, and repeat until NUM_CREATE threads have come and gone.
+int main(int argc, char *argv[])
+{
+  thread_t thread[MAX_THREAD];
+  void *retval;
+  int nthread, nround, i, j, start;
+
+  nthread = argc > 1 ? atoi(argv[1]) : 1;
+  if (nthread < 1 || nthread > MAX_THREAD) {
+    printf(1, "usage: thread_bench [nthread <= %d]\n", MAX_THREAD);
+    exit();
+  }
+  nround = NUM_CREATE / nthread;
+  start = uptime();
+  for (i = 0; i < nround; i++) {
+    for (j = 0; j < nthread; j++) {
+      thread[j] = j + 2;
+      if (thread_create(&thread[j], thread_main, 0) != 0) {
+        printf(1, "panic at thread_create\n");
+        exit();
+      }
+    }
+    for (j = 0; j < nthread; j++)
+      thread_join(thread[j], &retval);
+  }
+  report("thread_bench", nthread, nround * nthread, uptime() - start);
+  exit();
+}
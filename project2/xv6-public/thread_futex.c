@@ -0,0 +1,122 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NUM_THREAD 8
+#define NUM_INCREMENT 20000
+#define NUM_ITEM 2000
+#define BUFSIZE 4
+
+mutex_t lock;
+int counter;
+
+cond_t notempty, notfull;
+int buf[BUFSIZE];
+int head, tail, count;
+int consumed, sum;
+
+void *increment(void *arg)
+{
+  int i;
+  for (i = 0; i < NUM_INCREMENT; i++) {
+    mutex_lock(&lock);
+    counter++;
+    mutex_unlock(&lock);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void *producer(void *arg)
+{
+  int i;
+  for (i = 1; i <= NUM_ITEM; i++) {
+    mutex_lock(&lock);
+    while (count == BUFSIZE)
+      cond_wait(&notfull, &lock);
+    buf[tail] = i;
+    tail = (tail + 1) % BUFSIZE;
+    count++;
+    cond_signal(&notempty);
+    mutex_unlock(&lock);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void *consumer(void *arg)
+{
+  int v;
+  for (;;) {
+    mutex_lock(&lock);
+    while (count == 0 && consumed < NUM_ITEM)
+      cond_wait(&notempty, &lock);
+    if (consumed == NUM_ITEM) {
+      mutex_unlock(&lock);
+      break;
+    }
+    v = buf[head];
+    head = (head + 1) % BUFSIZE;
+    count--;
+    sum += v;
+    if (++consumed == NUM_ITEM)
+      cond_broadcast(&notempty);
+    cond_signal(&notfull);
+    mutex_unlock(&lock);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+thread_t thread[NUM_THREAD];
+
+int main(int argc, char *argv[])
+{
+  int i;
+  void *retval;
+
+  for (i = 0; i < NUM_THREAD; i++)
+    thread[i] = i + 2;
+
+  printf(1, "Thread futex test start\n");
+
+  printf(1, "Test 1: Mutex\n");
+  mutex_init(&lock);
+  for (i = 0; i < NUM_THREAD; i++) {
+    if (thread_create(&thread[i], increment, 0) != 0) {
+      printf(1, "panic at thread_create\n");
+      exit();
+    }
+  }
+  for (i = 0; i < NUM_THREAD; i++)
+    thread_join(thread[i], &retval);
+  if (counter != NUM_THREAD * NUM_INCREMENT) {
+    printf(1, "Test 1 failed: counter %d, expected %d\n", counter, NUM_THREAD * NUM_INCREMENT);
+    exit();
+  }
+  printf(1, "Test 1 passed\n");
+
+  printf(1, "Test 2: Condition variable\n");
+  cond_init(&notempty);
+  cond_init(&notfull);
+  if (thread_create(&thread[0], producer, 0) != 0) {
+    printf(1, "panic at thread_create\n");
+    exit();
+  }
+  for (i = 1; i < NUM_THREAD; i++) {
+    if (thread_create(&thread[i], consumer, 0) != 0) {
+      printf(1, "panic at thread_create\n");
+      exit();
+    }
+  }
+  for (i = 0; i < NUM_THREAD; i++)
+    thread_join(thread[i], &retval);
+  if (sum != NUM_ITEM * (NUM_ITEM + 1) / 2) {
+    printf(1, "Test 2 failed: sum %d, expected %d\n", sum, NUM_ITEM * (NUM_ITEM + 1) / 2);
+    exit();
+  }
+  printf(1, "Test 2 passed\n");
+
+  printf(1, "All tests passed!\n");
+  exit();
+}
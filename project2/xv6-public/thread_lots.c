@@ -0,0 +1,41 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NUM_THREAD 200
+
+void *thread_main(void *arg)
+{
+  sleep(50);
+  thread_exit((void *)((int)arg * 2));
+  return 0;
+}
+
+thread_t thread[NUM_THREAD];
+
+int main(int argc, char *argv[])
+{
+  int i;
+  void *retval;
+
+  for (i = 0; i < NUM_THREAD; i++){
+    thread[i] = i + 2;
+  }
+
+  printf(1, "Thread lots test start\n");
+  printf(1, "%d threads will be alive at the same time\n", NUM_THREAD);
+  for (i = 0; i < NUM_THREAD; i++) {
+    if (thread_create(&thread[i], thread_main, (void *)i) != 0) {
+      printf(1, "panic at thread_create %d\n", i);
+      exit();
+    }
+  }
+  for (i = NUM_THREAD - 1; i >= 0; i--) {
+    if (thread_join(thread[i], &retval) != 0 || (int)retval != i * 2) {
+      printf(1, "panic at thread_join %d\n", i);
+      exit();
+    }
+  }
+  printf(1, "Thread lots test finished\n");
+  exit();
+}
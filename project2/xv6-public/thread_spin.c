@@ -0,0 +1,102 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define PGSIZE 4096
+
+int ncpu;
+
+void check(int ok, char *what)
+{
+  if (!ok) {
+    printf(1, "%s failed\n", what);
+    exit();
+  }
+}
+
+// Pin the calling thread, with tid tid, to the last CPU and spin
+// there alone.
+void spin(int tid)
+{
+  check(set_affinity(getpid(), tid, 1 << (ncpu - 1)) == 0, "set_affinity");
+  for (;;)
+    ;
+}
+
+void *spinner(void *arg)
+{
+  spin((int)arg);
+  return 0;
+}
+
+// Start a thread spinning on the last CPU and keep the calling
+// thread off that CPU.
+void startspinner(void)
+{
+  thread_t t = 2;
+
+  check(set_affinity(getpid(), 1, 1) == 0, "set_affinity");
+  check(thread_create(&t, spinner, (void *)t) == 0, "thread_create");
+  sleep(10);
+}
+
+// kill() stops a process spinning in user space on another CPU.
+void killspinner(void)
+{
+  int pid;
+
+  if ((pid = fork()) == 0)
+    spin(1);
+  sleep(10);
+  check(kill(pid) == 0, "kill");
+  check(wait() == pid, "wait");
+  printf(1, "Test 1 passed\n");
+}
+
+// exit() stops a sibling thread spinning on another CPU.
+void exitspinner(void)
+{
+  if (fork() == 0) {
+    startspinner();
+    exit();
+  }
+  wait();
+  printf(1, "Test 2 passed\n");
+}
+
+// Shrinking memory waits for a sibling thread spinning on another
+// CPU to leave it.
+void shrinkspinner(void)
+{
+  char *p;
+
+  if (fork() == 0) {
+    startspinner();
+    p = sbrk(PGSIZE);
+    check(p != (char *)-1, "sbrk");
+    p[0] = 1;
+    check(sbrk(-PGSIZE) != (char *)-1, "shrink");
+    exit();
+  }
+  wait();
+  printf(1, "Test 3 passed\n");
+}
+
+int main(int argc, char *argv[])
+{
+  int all;
+
+  printf(1, "Thread spin test start\n");
+  all = get_affinity(getpid(), -1);
+  for (ncpu = 0; all & (1 << ncpu); ncpu++)
+    ;
+  if (ncpu < 2) {
+    printf(1, "Thread spin test needs 2 CPUs\n");
+    exit();
+  }
+  killspinner();
+  exitspinner();
+  shrinkspinner();
+  printf(1, "Thread spin test finished\n");
+  exit();
+}
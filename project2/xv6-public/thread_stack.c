@@ -0,0 +1,73 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NUM_THREAD 50
+
+// Touch n bytes of stack below the caller's frame.
+int touch(int n)
+{
+  char buf[1024];
+  int i, sum;
+
+  for (i = 0; i < sizeof(buf); i++)
+    buf[i] = i;
+  sum = 0;
+  if (n > sizeof(buf))
+    sum = touch(n - sizeof(buf));
+  for (i = 0; i < sizeof(buf); i++)
+    sum += buf[i];
+  return sum;
+}
+
+void *thread_main(void *arg)
+{
+  touch((int)arg);
+  thread_exit(arg);
+  return 0;
+}
+
+thread_t thread[NUM_THREAD];
+
+int main(int argc, char *argv[])
+{
+  int i, pid;
+  void *retval;
+
+  for (i = 0; i < NUM_THREAD; i++)
+    thread[i] = i + 2;
+
+  printf(1, "Thread stack test start\n");
+
+  // Threads fault their stack pages in on first touch.
+  printf(1, "[Test 1] lazy stacks\n");
+  for (i = 0; i < NUM_THREAD; i++) {
+    if (thread_create(&thread[i], thread_main, (void *)2048) != 0) {
+      printf(1, "panic at thread_create\n");
+      exit();
+    }
+  }
+  for (i = 0; i < NUM_THREAD; i++) {
+    if (thread_join(thread[i], &retval) != 0 || (int)retval != 2048) {
+      printf(1, "panic at thread_join\n");
+      exit();
+    }
+  }
+  printf(1, "[Test 1] finished\n");
+
+  // A thread that runs off the end of its stack hits the guard
+  // page and the process is killed.
+  printf(1, "[Test 2] guard page\n");
+  pid = fork();
+  if (pid == 0) {
+    thread_create(&thread[0], thread_main, (void *)(64*1024));
+    thread_join(thread[0], &retval);
+    printf(1, "panic: stack overflow not caught\n");
+    exit();
+  }
+  wait();
+  printf(1, "[Test 2] finished\n");
+
+  printf(1, "Thread stack test finished\n");
+  exit();
+}
@@ -0,0 +1,86 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NUM_THREAD 8
+#define NUM_INCREMENT 100000
+
+struct tls {
+  struct tls *self;
+  int id;
+  int count;
+};
+
+struct tls block[NUM_THREAD + 1];
+
+int tls_id(void)
+{
+  int id;
+  asm volatile("movl %%gs:4, %0" : "=r" (id));
+  return id;
+}
+
+void tls_inc(void)
+{
+  asm volatile("incl %%gs:8" : : : "memory");
+}
+
+void tls_set(int i)
+{
+  block[i].self = &block[i];
+  block[i].id = i;
+  thread_settls(&block[i]);
+}
+
+void *thread_main(void *arg)
+{
+  int i, id = (int)arg;
+
+  tls_set(id);
+  for (i = 0; i < NUM_INCREMENT; i++) {
+    tls_inc();
+    if (i % 10000 == 0)
+      sleep(1);
+    if (tls_id() != id) {
+      printf(1, "panic: thread %d sees tls of %d\n", id, tls_id());
+      exit();
+    }
+  }
+  thread_exit(0);
+  return 0;
+}
+
+thread_t thread[NUM_THREAD];
+
+int main(int argc, char *argv[])
+{
+  int i;
+  void *retval;
+
+  for (i = 0; i < NUM_THREAD; i++)
+    thread[i] = i + 2;
+
+  printf(1, "Thread tls test start\n");
+  tls_set(NUM_THREAD);
+  for (i = 0; i < NUM_THREAD; i++) {
+    if (thread_create(&thread[i], thread_main, (void *)i) != 0) {
+      printf(1, "panic at thread_create\n");
+      exit();
+    }
+  }
+  for (i = 0; i < NUM_THREAD; i++)
+    thread_join(thread[i], &retval);
+
+  if (tls_id() != NUM_THREAD) {
+    printf(1, "panic: main thread lost its tls\n");
+    exit();
+  }
+  for (i = 0; i < NUM_THREAD; i++) {
+    if (block[i].count != NUM_INCREMENT) {
+      printf(1, "Thread %d counted %d, expected %d\n", i, block[i].count, NUM_INCREMENT);
+      exit();
+    }
+  }
+  printf(1, "Thread tls test finished\n");
+  exit();
+}
@@ -0,0 +1,295 @@
+// Kernel timers for sleeping a number of ticks.
+//
+// Pending timers hang off a wheel of NTIMERSLOT slots, indexed
+// by their expiry tick modulo NTIMERSLOT. Each tick the clock
+// interrupt looks only at the slot for the current tick and
+// wakes the sleepers whose timers have expired, instead of
+// waking every sleeper so that it can check the time itself.
+// Timers more than one turn of the wheel away are passed over
+// until their turn comes.
+//
+// The wheel is protected by tickslock.
+//
+// In TICKLESS mode no CPU takes an interrupt every tick. ticks
+// is instead brought up to date from the TSC by clockupdate()
+// whenever it is needed, and CPU 0 programs its timer for the
+// next timer to expire (see nexttick), waking at least every
+// NOHZMAX ticks so that the TSC's low bits cannot wrap unseen.
+// Timers then also fire part of the way into a tick, to within
+// 1/TICKFRAC of a tick (see nanosleep).
+//
+// clocknow() reads the time to the same precision in either mode,
+// for charging threads the CPU time they use (see sched).
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+
+#define NTIMERSLOT 64
+
+struct timer {
+  uint expire;           // Value of ticks at which to fire
+  uint frac;             // TICKFRAC-ths of a tick after expire
+  int fired;             // Has it fired?
+  struct timer *next;    // Next timer in the same slot
+};
+
+static struct timer *wheel[NTIMERSLOT];
+
+// TICKLESS timekeeping. These are written under tickslock, but
+// nexttick() reads them without it.
+static volatile uint lastclock;  // TSC when ticks last advanced
+static volatile uint nexttimer;  // Expiry of the earliest timer, or 0
+static volatile uint nextfrac;   // and its frac
+static volatile uint timerdue;   // CPU 0 is due an interrupt by then,
+                                 // or 0 while it reprograms its timer
+static volatile uint clockseq;   // Odd while ticks and lastclock change
+
+void
+timerinit(void)
+{
+  lastclock = rdtsc();
+}
+
+// Does a timer expiring at tick expire plus frac fire before one
+// at tick expire2 plus frac2?
+static int
+earlier(uint expire, uint frac, uint expire2, uint frac2)
+{
+  if(expire != expire2)
+    return (int)(expire - expire2) < 0;
+  return frac < frac2;
+}
+
+// TSC cycles since it read clock. The TSCs of the CPUs need not
+// agree exactly, and clock may have been read on another CPU just
+// ahead of this one: count that as no time rather than as a
+// difference that wraps around to nearly 2^32.
+static uint
+tscsince(uint clock)
+{
+  uint d;
+
+  d = rdtsc() - clock;
+  return (int)d < 0 ? 0 : d;
+}
+
+// TICKFRAC-ths of a tick since the TSC read clock; in TICKLESS
+// mode, clock is lastclock, when ticks last advanced.
+static uint
+sincetick(uint clock)
+{
+  if(!TICKLESS)
+    return 0;
+  return tscsince(clock) / (tsctick / TICKFRAC);
+}
+
+// Add tm to the wheel. Caller must hold tickslock.
+static void
+timeradd(struct timer *tm)
+{
+  struct timer **slot = &wheel[tm->expire % NTIMERSLOT];
+
+  tm->fired = 0;
+  tm->next = *slot;
+  *slot = tm;
+  if(nexttimer == 0 || earlier(tm->expire, tm->frac, nexttimer, nextfrac)){
+    nexttimer = tm->expire;
+    nextfrac = tm->frac;
+  }
+}
+
+// Remove tm from the wheel if it has not fired yet.
+// Caller must hold tickslock.
+static void
+timerdel(struct timer *tm)
+{
+  struct timer **pp;
+
+  for(pp = &wheel[tm->expire % NTIMERSLOT]; *pp; pp = &(*pp)->next){
+    if(*pp == tm){
+      *pp = tm->next;
+      return;
+    }
+  }
+}
+
+// Fire the timers that expire in the current tick: those due by
+// now, or all of them if the tick is over.
+// Caller must hold tickslock.
+static void
+timerfire(int over)
+{
+  struct timer **pp, *tm;
+  uint now;
+  int i;
+
+  now = sincetick(lastclock);
+  pp = &wheel[ticks % NTIMERSLOT];
+  while((tm = *pp) != 0){
+    if(tm->expire == ticks && (over || tm->frac <= now)){
+      *pp = tm->next;
+      tm->fired = 1;
+      wakeup(tm);
+    } else
+      pp = &tm->next;
+  }
+
+  // Find the next timer to expire once the earliest has fired.
+  if(nexttimer == 0 || (int)(nexttimer - ticks) > 0 ||
+     (nexttimer == ticks && !over && nextfrac > now))
+    return;
+  nexttimer = 0;
+  for(i = 0; i < NTIMERSLOT; i++){
+    for(tm = wheel[i]; tm; tm = tm->next){
+      if(nexttimer == 0 || earlier(tm->expire, tm->frac, nexttimer, nextfrac)){
+        nexttimer = tm->expire;
+        nextfrac = tm->frac;
+      }
+    }
+  }
+}
+
+// Set ticks to t, which began when the TSC read clock; ticks
+// first, since nexttick() reads lastclock first.
+// Caller must hold tickslock.
+static void
+clockset(uint t, uint clock)
+{
+  clockseq++;
+  __sync_synchronize();
+  ticks = t;
+  lastclock = clock;
+  __sync_synchronize();
+  clockseq++;
+}
+
+// Advance ticks by one and fire the timers that expire then.
+// Called by the clock interrupt with tickslock held.
+void
+timertick(void)
+{
+  clockset(ticks + 1, rdtsc());
+  timerfire(0);
+}
+
+// In TICKLESS mode, advance ticks by the clock ticks the TSC
+// says have passed, firing timers on the way.
+// Caller must hold tickslock.
+void
+clockupdate(void)
+{
+  if(!TICKLESS)
+    return;
+  while(tscsince(lastclock) >= tsctick){
+    timerfire(1);
+    clockset(ticks + 1, lastclock + tsctick);
+  }
+  timerfire(0);
+}
+
+// The time in TICKFRAC-ths of a tick, from ticks and the TSC
+// cycles since. Wraps around, so only differences mean anything.
+// Takes no lock: it retries if ticks advances meanwhile.
+uint
+clocknow(void)
+{
+  uint seq, t, d, frac;
+
+  do {
+    seq = clockseq;
+    __sync_synchronize();
+    t = ticks;
+    d = tscsince(lastclock);
+    __sync_synchronize();
+  } while((seq & 1) || seq != clockseq);
+  if(TICKLESS){
+    t += d / tsctick;
+    d %= tsctick;
+  }
+  // tsctick / TICKFRAC rounds down, and a periodic interrupt may
+  // come late; either way time must not run backwards when ticks
+  // advances.
+  frac = d / (tsctick / TICKFRAC);
+  if(frac >= TICKFRAC)
+    frac = TICKFRAC - 1;
+  return t * TICKFRAC + frac;
+}
+
+// How long CPU 0 may go before its next timer interrupt, in
+// TICKFRAC-ths of a tick: until the next timer expires, but at
+// most NOHZMAX ticks. Called by CPU 0 with interrupts disabled as
+// it reprograms its timer.
+uint
+nexttick(void)
+{
+  uint clock, now, due, n;
+
+  xchg(&timerdue, 0);
+  clock = lastclock;
+  __sync_synchronize();
+  // ticks may have advanced since; then the timer fires early.
+  now = sincetick(clock);
+  n = NOHZMAX * TICKFRAC;
+  due = nexttimer;
+  if(due != 0 && (int)(due - ticks) <= NOHZMAX){
+    due = (due - ticks) * TICKFRAC + nextfrac;
+    if((int)(due - now) < (int)n)
+      n = (int)(due - now) > 0 ? due - now : 1;
+  }
+  timerdue = ticks + (now + n) / TICKFRAC;
+  return n;
+}
+
+// Sleep for n ticks plus frac TICKFRAC-ths of a tick from now;
+// without TICKLESS, frac is rounded up to a whole tick. frac 0
+// wakes at the start of a tick, as sleep() always has.
+// Returns -1 if the thread is killed before the time has passed,
+// 0 otherwise.
+int
+tsleep(uint n, uint frac)
+{
+  struct timer tm;
+  uint due;
+
+  if(!TICKLESS){
+    n += (frac + TICKFRAC - 1) / TICKFRAC;
+    frac = 0;
+  }
+  if(n == 0 && frac == 0)
+    return 0;
+  acquire(&tickslock);
+  clockupdate();
+  if(frac > 0){
+    frac += sincetick(lastclock);
+    n += frac / TICKFRAC;
+    frac %= TICKFRAC;
+  }
+  tm.expire = ticks + n;
+  tm.frac = frac;
+  timeradd(&tm);
+  if(TICKLESS && cpuid() != 0){
+    // Make CPU 0 reprogram its timer if it would fire too late.
+    // If CPU 0 is the one going to sleep, it will on its way to
+    // the scheduler.
+    __sync_synchronize();
+    due = timerdue;
+    if(due == 0 || (int)(tm.expire - due) <= 0)
+      lapicipi(cpus[0].apicid, T_IRQ0 + IRQ_WAKEUP);
+  }
+  while(!tm.fired){
+    if(myproc()->killed || mythread()->killed){
+      timerdel(&tm);
+      release(&tickslock);
+      return -1;
+    }
+    sleep(&tm, &tickslock);
+  }
+  release(&tickslock);
+  return 0;
+}
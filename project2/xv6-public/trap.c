@@ -3,10 +3,10 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "x86.h"
 #include "traps.h"
-#include "spinlock.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
@@ -37,21 +37,27 @@ void
 trap(struct trapframe *tf)
 {
   if(tf->trapno == T_SYSCALL){
-    if(myproc()->killed)
+    if(myproc()->killed || mythread()->killed)
       exit();
-    myproc()->t[myproc()->tidx].tf = tf;
+    mythread()->tf = tf;
     syscall();
-    if(myproc()->killed)
+    if(myproc()->killed || mythread()->killed)
       exit();
     return;
   }
 
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
-    if(cpuid() == 0){
+    mycpu()->ntimer++;
+    if(TICKLESS){
+      // Whatever this interrupt is for, the scheduler reprograms
+      // the timer before it runs a thread or halts.
+      acquire(&tickslock);
+      clockupdate();
+      release(&tickslock);
+    } else if(cpuid() == 0){
       acquire(&tickslock);
-      ticks++;
-      wakeup(&ticks);
+      timertick();
       release(&tickslock);
     }
     lapiceoi();
@@ -71,6 +77,12 @@ trap(struct trapframe *tf)
     uartintr();
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_WAKEUP:
+    // Ends a hlt in scheduler(), or tells a TICKLESS CPU that
+    // it has new work to time or a timer due earlier.
+    armtimer();
+    lapiceoi();
+    break;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n",
@@ -78,6 +90,20 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // First touch of a page of user memory, or write to a page
+    // shared copy-on-write or backed by the zero page.
+    if(myproc() && (tf->cs&3) == DPL_USER &&
+       pagefault(rcr2(), tf->err & PTE_W) == 0)
+      break;
+    // A system call writing to such a shared page; syscall.c has
+    // mapped the pages the kernel may touch. Breaking the share
+    // counts against the memory limit as a user write would.
+    if(myproc() && (tf->err & (PTE_P|PTE_W)) == (PTE_P|PTE_W) &&
+       pagefault(rcr2(), 1) == 0)
+      break;
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -96,19 +122,21 @@ trap(struct trapframe *tf)
 
   // Force process exit if it has been killed and is in user space.
   // (If it is still executing in the kernel, let it keep running
-  // until it gets to the regular system call return.)
-  if(myproc() && myproc()->killed)// && (tf->cs&3) == DPL_USER)
+  // until it gets to the regular system call return: with threads
+  // running on other CPUs it may well be holding a sleep-lock.)
+  if(myproc() && (myproc()->killed || mythread()->killed) &&
+     (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force thread to give up CPU on clock tick, or as soon as an
+  // EDF job is queued to preempt it (see rtkick).
   // If interrupts were on while locks held, would need to check nlock.
-  if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER){
-      // cprintf("\n");
+  if(myproc() && mythread()->state == RUNNING &&
+     (tf->trapno == T_IRQ0+IRQ_TIMER || rtpreempt()))
     yield();
-     }
 
   // Check if the process has been killed since we yielded
-  if(myproc() && myproc()->killed)// && (tf->cs&3) == DPL_USER)
+  if(myproc() && (myproc()->killed || mythread()->killed) &&
+     (tf->cs&3) == DPL_USER)
     exit();
 }
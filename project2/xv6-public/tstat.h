@@ -0,0 +1,13 @@
+// Scheduling statistics of one thread, as returned by threadstat().
+struct tstat {
+  int pid;          // Process ID
+  int tid;          // Thread ID
+  int state;        // enum procstate
+  int cpu;          // Last CPU the thread ran on
+  uint affinity;    // Mask of CPUs the thread may run on
+  uint runticks;    // Ticks spent running
+  uint waitticks;   // Ticks spent RUNNABLE but not running
+  uint nvswitch;    // Switches because the thread went to sleep
+  uint nivswitch;   // Switches because its time slice ran out
+  uint nmiss;       // Deadlines missed by its process (EDF)
+};
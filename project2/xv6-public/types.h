@@ -3,3 +3,5 @@ typedef unsigned short ushort;
 typedef unsigned char  uchar;
 typedef uint pde_t;
 typedef uint thread_t;
+typedef struct { volatile uint state; } mutex_t;
+typedef struct { volatile uint seq; } cond_t;
@@ -104,3 +104,63 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// Mutex and condition variable for threads, blocking in the
+// kernel with futex_wait/futex_wake when contended.
+// Mutex state: 0 unlocked, 1 locked, 2 locked and maybe waiters.
+void
+mutex_init(mutex_t *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(mutex_t *m)
+{
+  if(xchg(&m->state, 1) == 0)
+    return;
+  while(xchg(&m->state, 2) != 0)
+    futex_wait(&m->state, 2);
+}
+
+void
+mutex_unlock(mutex_t *m)
+{
+  if(xchg(&m->state, 0) == 2)
+    futex_wake(&m->state, 1);
+}
+
+void
+cond_init(cond_t *c)
+{
+  c->seq = 0;
+}
+
+// Callers must recheck their condition on return.
+void
+cond_wait(cond_t *c, mutex_t *m)
+{
+  uint seq;
+
+  seq = c->seq;
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  // Others may have queued behind m meanwhile; take it
+  // as contended so that our unlock wakes them.
+  while(xchg(&m->state, 2) != 0)
+    futex_wait(&m->state, 2);
+}
+
+void
+cond_signal(cond_t *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(cond_t *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake(&c->seq, 0x7fffffff);  // all waiters
+}
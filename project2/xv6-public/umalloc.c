@@ -2,6 +2,7 @@
 #include "stat.h"
 #include "user.h"
 #include "param.h"
+#include "x86.h"
 
 // Memory allocator by Kernighan and Ritchie,
 // The C programming Language, 2nd ed.  Section 8.7.
@@ -21,8 +22,25 @@ typedef union header Header;
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+// Threads of a process share the free list and may run on
+// different CPUs at the same time.
+static volatile uint locked;
+
+static void
+lock(void)
+{
+  while(xchg(&locked, 1) != 0)
+    ;
+}
+
+static void
+unlock(void)
+{
+  xchg(&locked, 0);
+}
+
+static void
+freeblock(void *ap)
 {
   Header *bp, *p;
 
@@ -56,10 +74,18 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  freeblock((void*)(hp + 1));
   return freep;
 }
 
+void
+free(void *ap)
+{
+  lock();
+  freeblock(ap);
+  unlock();
+}
+
 void*
 malloc(uint nbytes)
 {
@@ -67,6 +93,7 @@ malloc(uint nbytes)
   uint nunits;
 
   nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  lock();
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
@@ -81,10 +108,13 @@ malloc(uint nbytes)
         p->s.size = nunits;
       }
       freep = prevp;
+      unlock();
       return (void*)(p + 1);
     }
     if(p == freep)
-      if((p = morecore(nunits)) == 0)
+      if((p = morecore(nunits)) == 0){
+        unlock();
         return 0;
+      }
   }
 }
@@ -1,4 +1,5 @@
 struct stat;
+struct tstat;
 struct rtcdate;
 
 // system calls
@@ -29,6 +30,17 @@ int setmemorylimit(int, int);
 int thread_create(thread_t *, void *(*)(void *), void *);
 void thread_exit(void *);
 int thread_join(thread_t, void **);
+int futex_wait(volatile uint *, uint);
+int futex_wake(volatile uint *, int);
+int thread_settls(void*);
+int threadstat(struct tstat*, int);
+int set_affinity(int, int, int);
+int get_affinity(int, int);
+int set_tickets(int, int, int);
+int nanosleep(int, int);
+int set_deadline(int, int, int, int);
+int yield(void);
+int spawn(char*, char**, int, int*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -43,3 +55,10 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+void mutex_init(mutex_t*);
+void mutex_lock(mutex_t*);
+void mutex_unlock(mutex_t*);
+void cond_init(cond_t*);
+void cond_wait(cond_t*, mutex_t*);
+void cond_signal(cond_t*);
+void cond_broadcast(cond_t*);
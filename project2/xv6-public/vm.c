@@ -4,11 +4,13 @@
 #include "x86.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "elf.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
+static char *zeropage;  // backs user pages that were only read
 
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
@@ -142,6 +144,9 @@ kvmalloc(void)
 {
   kpgdir = setupkvm();
   switchkvm();
+  if((zeropage = kalloc()) == 0)
+    panic("kvmalloc");
+  memset(zeropage, 0, PGSIZE);
 }
 
 // Switch h/w page table register to the kernel-only page table,
@@ -152,23 +157,37 @@ switchkvm(void)
   lcr3(V2P(kpgdir));   // switch to the kernel page table
 }
 
-// Switch TSS and h/w page table to correspond to process p.
+// Drop this CPU's cached translations for pgdir after its
+// page table entries changed, if pgdir is the one in use.
+static void
+flushtlb(pde_t *pgdir)
+{
+  if(rcr3() == V2P(pgdir))
+    lcr3(V2P(pgdir));
+}
+
+// Switch TSS and h/w page table to correspond to process p
+// and the thread of p this CPU is running.
 void
 switchuvm(struct proc *p)
 {
+  struct thread *t;
+
   if(p == 0)
     panic("switchuvm: no process");
-  if(p->t[p->tidx].kstack == 0)
-    panic("switchuvm: no kstack");
   if(p->pgdir == 0)
     panic("switchuvm: no pgdir");
 
   pushcli();
+  t = mycpu()->thread;
+  if(t == 0 || t->kstack == 0)
+    panic("switchuvm: no kstack");
   mycpu()->gdt[SEG_TSS] = SEG16(STS_T32A, &mycpu()->ts,
                                 sizeof(mycpu()->ts)-1, 0);
   mycpu()->gdt[SEG_TSS].s = 0;
   mycpu()->ts.ss0 = SEG_KDATA << 3;
-  mycpu()->ts.esp0 = (uint)p->t[p->tidx].kstack + KSTACKSIZE;
+  mycpu()->ts.esp0 = (uint)t->kstack + KSTACKSIZE;
+  mycpu()->gdt[SEG_UTLS] = SEG(STA_W, t->tls, 0xffffffff, DPL_USER);
   // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
@@ -192,27 +211,43 @@ inituvm(pde_t *pgdir, char *init, uint sz)
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
+// Read a page of a file-backed segment into a new page: n bytes
+// of ip from offset off, then zeros. Returns the page, or 0.
+// Sleeps, so the caller must hold no spinlock.
+char*
+readpage(struct inode *ip, uint off, uint n)
+{
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  ilock(ip);
+  if(readi(ip, mem, off, n) != n){
+    iunlock(ip);
+    kfree(mem);
+    return 0;
+  }
+  iunlock(ip);
+  return mem;
+}
+
+// Map the page mem at va with permissions perm, unless a page is
+// mapped at va already, in which case mem is freed.
+// Returns 0 if a page is mapped at va, -1 if out of memory.
 int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
+installpage(pde_t *pgdir, uint va, char *mem, int perm)
 {
-  uint i, pa, n;
   pte_t *pte;
 
-  if((uint) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
-      return -1;
+  if((pte = walkpgdir(pgdir, (char*)va, 1)) == 0){
+    kfree(mem);
+    return -1;
   }
+  if(*pte & PTE_P)
+    kfree(mem);
+  else
+    *pte = V2P(mem) | perm | PTE_P;
   return 0;
 }
 
@@ -271,7 +306,8 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       if(pa == 0)
         panic("kfree");
       char *v = P2V(pa);
-      kfree(v);
+      if(v != zeropage)
+        kfree(v);
       *pte = 0;
     }
   }
@@ -297,6 +333,19 @@ freevm(pde_t *pgdir)
   kfree((char*)pgdir);
 }
 
+// Map the zero page at va without PTE_U. Used to create an
+// inaccessible page beneath a user stack that costs no memory.
+int
+guardpage(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+
+  if((pte = walkpgdir(pgdir, (char*)va, 1)) == 0)
+    return -1;
+  *pte = V2P(zeropage) | PTE_P;
+  return 0;
+}
+
 // Clear PTE_U on a page. Used to create an inaccessible
 // page beneath the user stack.
 void
@@ -313,7 +362,7 @@ clearpteu(pde_t *pgdir, char *uva)
 // Given a parent process's page table, create a copy
 // of it for a child.
 pde_t*
-copyuvm(pde_t *pgdir, uint sz)
+copyuvm(pde_t *pgdir, uint sz, int cow)
 {
   pde_t *d;
   pte_t *pte;
@@ -323,12 +372,42 @@ copyuvm(pde_t *pgdir, uint sz)
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    // Pages that were never touched stay unmapped in the child
+    // too (see demandpage).
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || !(*pte & PTE_P))
+      continue;
+    if(P2V(PTE_ADDR(*pte)) == zeropage){
+      if(mappages(d, (void*)i, PGSIZE, V2P(zeropage), PTE_FLAGS(*pte)) < 0)
+        goto bad;
+      continue;
+    }
+    if(!(*pte & (PTE_W | PTE_COW))){
+      // Read-only program pages are never written; share them.
+      pa = PTE_ADDR(*pte);
+      kref(P2V(pa));
+      if(mappages(d, (void*)i, PGSIZE, pa, PTE_FLAGS(*pte)) < 0){
+        kfree(P2V(pa));
+        goto bad;
+      }
+      continue;
+    }
+    if(cow && (*pte & (PTE_W | PTE_COW))){
+      // Share the page read-only; the first write to it from
+      // either side takes a private copy (see cowpage).
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+      pa = PTE_ADDR(*pte);
+      kref(P2V(pa));
+      if(mappages(d, (void*)i, PGSIZE, pa, PTE_FLAGS(*pte)) < 0){
+        kfree(P2V(pa));
+        goto bad;
+      }
+      continue;
+    }
     pa = PTE_ADDR(*pte);
+    // A private copy is writable even if the original is shared.
     flags = PTE_FLAGS(*pte);
+    if(flags & PTE_COW)
+      flags = (flags & ~PTE_COW) | PTE_W;
     if((mem = kalloc()) == 0)
       goto bad;
     memmove(mem, (char*)P2V(pa), PGSIZE);
@@ -337,13 +416,128 @@ copyuvm(pde_t *pgdir, uint sz)
       goto bad;
     }
   }
+  if(cow)
+    flushtlb(pgdir);
   return d;
 
 bad:
+  if(cow)
+    flushtlb(pgdir);
   freevm(d);
   return 0;
 }
 
+// Give pgdir a private, writable copy of the copy-on-write page
+// at va, copying it only if some other page table still maps it.
+// The zero page is never written; it is replaced by a new page.
+// Returns 0 if the page at va is now writable, -1 if it is not
+// a copy-on-write page or memory ran out.
+// The caller's process must be single-threaded (see fork), so
+// only this CPU's TLB can hold the old mapping.
+int
+cowpage(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa;
+  char *mem;
+
+  if(va >= KERNBASE || (pte = walkpgdir(pgdir, (void*)va, 0)) == 0 ||
+     !(*pte & PTE_P))
+    return -1;
+  if(*pte & PTE_W)
+    return 0;
+  if(!(*pte & PTE_COW))
+    return -1;
+  pa = PTE_ADDR(*pte);
+  if(P2V(pa) == zeropage){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    pa = V2P(mem);
+  } else if(krefcount(P2V(pa)) > 1){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char*)P2V(pa), PGSIZE);
+    kfree(P2V(pa));
+    pa = V2P(mem);
+  }
+  *pte = pa | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  flushtlb(pgdir);
+  return 0;
+}
+
+// Take private copies of all copy-on-write pages below sz,
+// including those backed by the zero page, before the process
+// gets a second thread.
+// Returns 0 on success, -1 if memory ran out.
+int
+unshareuvm(pde_t *pgdir, uint sz)
+{
+  pte_t *pte;
+  uint i;
+
+  for(i = 0; i < sz; i += PGSIZE){
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 ||
+       (*pte & (PTE_P | PTE_COW)) != (PTE_P | PTE_COW))
+      continue;
+    if(cowpage(pgdir, i) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Map the page at va, which was never touched: a new zeroed page
+// if write is set, else the zero page, read-only until the first
+// write (see cowpage). A copy-on-write page already mapped at va
+// is made writable if write is set.
+// Returns 0 if the page at va can now be accessed as asked,
+// -1 if it is not a user page or memory ran out.
+int
+demandpage(pde_t *pgdir, uint va, int write)
+{
+  pte_t *pte;
+  char *mem;
+
+  if(va >= KERNBASE || (pte = walkpgdir(pgdir, (void*)va, 1)) == 0)
+    return -1;
+  if(*pte & PTE_P){
+    if(!(*pte & PTE_U))
+      return -1;
+    if(write && !(*pte & PTE_W))
+      return cowpage(pgdir, va);
+    return 0;
+  }
+  if(!write){
+    *pte = V2P(zeropage) | PTE_P | PTE_U | PTE_COW;
+    return 0;
+  }
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  *pte = V2P(mem) | PTE_P | PTE_W | PTE_U;
+  return 0;
+}
+
+// The number of pages in [start, end) that are mapped to memory
+// of their own, rather than to the zero page or not at all.
+int
+countuvm(pde_t *pgdir, uint start, uint end)
+{
+  pte_t *pte;
+  uint a;
+  int n;
+
+  n = 0;
+  for(a = PGROUNDDOWN(start); a < end; a += PGSIZE){
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(!pte)
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+    else if((*pte & PTE_P) && P2V(PTE_ADDR(*pte)) != zeropage)
+      n++;
+  }
+  return n;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -352,7 +546,7 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -361,19 +555,23 @@ uva2ka(pde_t *pgdir, char *uva)
 
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
-// uva2ka ensures this only works for PTE_U pages.
+// Writes through the kernel mapping don't fault, so the pages
+// must already be mapped writable: the caller maps untouched
+// pages and breaks copy-on-write sharing first (see pagefault).
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
-    pa0 = uva2ka(pgdir, (char*)va0);
-    if(pa0 == 0)
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte == 0 || (*pte & (PTE_P|PTE_U|PTE_W)) != (PTE_P|PTE_U|PTE_W))
       return -1;
+    pa0 = (char*)P2V(PTE_ADDR(*pte));
     n = PGSIZE - (va - va0);
     if(n > len)
       n = len;
@@ -117,6 +117,25 @@ sti(void)
   asm volatile("sti");
 }
 
+// Enable interrupts and halt until the next one. The instruction
+// after sti runs before any interrupt is taken, so an interrupt
+// that was pending cannot slip in before the hlt.
+static inline void
+stihlt(void)
+{
+  asm volatile("sti; hlt");
+}
+
+// Low 32 bits of the time-stamp counter.
+static inline uint
+rdtsc(void)
+{
+  uint lo;
+
+  asm volatile("rdtsc" : "=a" (lo) : : "edx");
+  return lo;
+}
+
 static inline uint
 xchg(volatile uint *addr, uint newval)
 {
@@ -144,6 +163,14 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline uint
+rcr3(void)
+{
+  uint val;
+  asm volatile("movl %%cr3,%0" : "=r" (val));
+  return val;
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().
@@ -0,0 +1,49 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+#define NUM_YIELD 5000
+
+// Print the result line for ops operations done in ticks.
+void report(char *name, int nproc, uint ops, uint ticks)
+{
+  uint us;
+
+  if (ticks == 0)
+    ticks = 1;
+  us = ticks * (TICKNS / 1000);
+  printf(1, "%s nproc=%d ops=%d ticks=%d ops_per_sec=%d ns_per_op=%d\n",
+         name, nproc, ops, ticks, ops * (1000000000 / TICKNS) / ticks,
+         us / ops * 1000 + us % ops * 1000 / ops);
+}
+
+// yield() throughput: nproc processes each call yield()
+// NUM_YIELD times at once.
+int main(int argc, char *argv[])
+{
+  int nproc, i, j, go[2], start;
+  char c;
+
+  nproc = argc > 1 ? atoi(argv[1]) : 1;
+  if (nproc < 1 || pipe(go) < 0) {
+    printf(1, "usage: yield_bench [nproc]\n");
+    exit();
+  }
+  for (i = 0; i < nproc; i++) {
+    if (fork() == 0) {
+      read(go[0], &c, 1);
+      for (j = 0; j < NUM_YIELD; j++)
+        yield();
+      exit();
+    }
+  }
+  sleep(5);
+  start = uptime();
+  for (i = 0; i < nproc; i++)
+    write(go[1], "g", 1);
+  for (i = 0; i < nproc; i++)
+    wait();
+  report("yield_bench", nproc, nproc * NUM_YIELD, uptime() - start);
+  exit();
+}